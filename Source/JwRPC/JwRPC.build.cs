@@ -25,6 +25,7 @@ public class JwRPC : ModuleRules
                 "Json",
                 "JsonUtilities",
                 "JsonBP",
+                "WebSocketNetworking",
 				// ... add other public dependencies that you statically link with here ...
 			});
 			
@@ -32,9 +33,7 @@ public class JwRPC : ModuleRules
 		PrivateDependencyModuleNames.AddRange(
 			new string[]
 			{
-
-				
-                
+                "Sockets",
 				// ... add private dependencies that you statically link with here ...	
 			});
     }
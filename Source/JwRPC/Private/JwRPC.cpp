@@ -6,6 +6,10 @@
 #include "CondensedJsonPrintPolicy.h"
 #include "JsonBP.h"
 #include "WebSocketsModule.h"
+#include "JwRPCCapture.h"
+#include "JwRPCSubsystem.h"
+#include "JwRPCStreamSocket.h"
+#include "JwRPCFuture.h"
 
 void FJwRPCModule::StartupModule()
 {
@@ -27,10 +31,12 @@ DEFINE_LOG_CATEGORY(LogJwRPC)
 UJwRpcConnection::UJwRpcConnection()
 {
 	//UE_SET_LOG_VERBOSITY(LogJwRPC, NoLogging);
+
+	Lanes[(int)EJwRpcLane::Bulk].BytesPerTick = 64 * 1024;
 }
 
 
-void UJwRpcConnection::Request(const FString& method, const FString& params, FSuccessCB onSuccess, FErrorCB onError)
+FJwRpcRequestHandle UJwRpcConnection::Request(const FString& method, const FString& params, FSuccessCB onSuccess, FErrorCB onError, EJwRpcLane lane)
 {
 	FString id = GenId();
 
@@ -38,7 +44,8 @@ void UJwRpcConnection::Request(const FString& method, const FString& params, FSu
 	req.Method = method;
 	req.OnResult = onSuccess;
 	req.OnError = onError;
-	req.ExpireTime = TimeSinceStart + DefaultTimeout;
+	req.ExpireTime = GetTime() + GetRequestTimeout(method);
+	req.SendTime = FPlatformTime::Seconds();
 
 	//if (FTimerManager* pTimer = TryGetTimerManager())
 	//{
@@ -61,35 +68,183 @@ void UJwRpcConnection::Request(const FString& method, const FString& params, FSu
 	//}
 
 	const FString finalData = FString::Printf(TEXT(R"({"id":"%s","method":"%s","params":%s})"), *id, *method, *params);
-	if (Connection)
+	if (BatchDepth > 0)
+	{
+		AddToBatch(finalData, GetLane(lane, method), id);
+	}
+	else if (Connection)
 	{
-		Connection->Send(finalData);
+		SendOnLane(finalData, GetLane(lane, method), { id });
 	}
 	
 	UE_LOG(LogJwRPC, Warning, TEXT("OutgingData:%s"), *finalData);
 
+	NextExpireTime = FMath::Min(NextExpireTime, req.ExpireTime);
 	Requests.Add(id, MoveTemp(req));
+	ScheduleUpdate();
+
+	FJwRpcRequestHandle handle;
+	handle.Id = id;
+	handle.Connection = this;
+	return handle;
+}
+
+FJwRpcRequestHandle UJwRpcConnection::Request(const FString& method, TSharedPtr<FJsonValue> params, FSuccessCB onSuccess, FErrorCB onError, EJwRpcLane lane)
+{
+	return Request(method, params ? HelperStringifyJSON(params) : FString(), onSuccess, onError, lane);
+}
+
+FJwRpcFuture UJwRpcConnection::RequestAsync(const FString& method, const FString& params, EJwRpcLane lane)
+{
+	FJwRpcPromise promise;
+	Request(method, params, FSuccessCB::CreateLambda([promise](TSharedPtr<FJsonValue> result) {
+		promise.SetValue(result);
+	}), FErrorCB::CreateLambda([promise](const FJwRPCError& error) {
+		promise.SetError(error);
+	}), lane);
+
+	return promise.GetFuture();
+}
+
+FJwRpcFuture UJwRpcConnection::RequestAsync(const FString& method, TSharedPtr<FJsonValue> params, EJwRpcLane lane)
+{
+	return RequestAsync(method, params ? HelperStringifyJSON(params) : FString(), lane);
+}
+
+FJwRpcFuture UJwRpcConnection::RequestAll(const TArray<FJwRpcCall>& calls, TArray<FJwRpcFuture>* outFutures)
+{
+	TArray<FJwRpcFuture> futures;
+	futures.Reserve(calls.Num());
+
+	BeginBatch();
+	for (const FJwRpcCall& call : calls)
+		futures.Add(RequestAsync(call.Method, call.Params));
+	EndBatch();
+
+	if (outFutures)
+		*outFutures = futures;
+
+	return FJwRpcFuture::WhenAll(futures);
+}
+
+void UJwRpcConnection::BeginBatch()
+{
+	BatchDepth++;
+}
+
+void UJwRpcConnection::EndBatch()
+{
+	if (BatchDepth <= 0 || --BatchDepth > 0)
+		return;
+
+	TArray<FString> messages = MoveTemp(BatchMessages);
+	BatchMessages.Reset();
+	TArray<FString> requestIds;
+	for (FString& id : BatchRequestIds)
+	{
+		if (!id.IsEmpty())
+			requestIds.Add(MoveTemp(id));
+	}
+	BatchRequestIds.Reset();
+	const EJwRpcLane lane = BatchLane;
+	BatchLane = EJwRpcLane::Bulk;
+
+	if (messages.Num() == 0 || !Connection)
+		return;
+
+	//a batch is a single frame, it goes on the most urgent lane of its messages
+	if (messages.Num() == 1)
+		SendOnLane(messages[0], lane, requestIds);
+	else
+		SendOnLane(TEXT("[") + FString::Join(messages, TEXT(",")) + TEXT("]"), lane, requestIds, true);
 }
 
-void UJwRpcConnection::Request(const FString& method, TSharedPtr<FJsonValue> params, FSuccessCB onSuccess, FErrorCB onError)
+void UJwRpcConnection::AddToBatch(const FString& data, EJwRpcLane lane, const FString& requestId)
 {
-	return Request(method, params ? HelperStringifyJSON(params) : FString(), onSuccess, onError);
+	BatchMessages.Add(data);
+	BatchRequestIds.Add(requestId);
+	if ((uint8)lane < (uint8)BatchLane)
+		BatchLane = lane;
 }
 
 
-void UJwRpcConnection::Notify(const FString& method, const FString& params)
+void UJwRpcConnection::Notify(const FString& method, const FString& params, EJwRpcLane lane)
 {
 	if (Connection)
 	{
 		const FString finalData = FString::Printf(TEXT(R"({"method":"%s","params":%s})"), *method, *params);
-		Connection->Send(finalData);
+		if (BatchDepth > 0)
+			AddToBatch(finalData, GetLane(lane, method), FString());
+		else
+			SendOnLane(finalData, GetLane(lane, method));
 		UE_LOG(LogJwRPC, Warning, TEXT("OutgingData:%s"), *finalData);
 	}
 }
 
-void UJwRpcConnection::Notify(const FString& method, TSharedPtr<FJsonValue> params)
+void UJwRpcConnection::Notify(const FString& method, TSharedPtr<FJsonValue> params, EJwRpcLane lane)
+{
+	return Notify(method, params ? HelperStringifyJSON(params) : FString(), lane);
+}
+
+void UJwRpcConnection::NotifyCoalesced(const FString& method, TSharedPtr<FJsonValue> params, const FString& key, EJwRpcLane lane)
+{
+	FCoalescedNotify& notify = CoalescedNotifies.FindOrAdd(TPair<FString, FString>(method, key));
+	notify.Method = method;
+	notify.Params = params;
+	notify.ParamsString.Reset();
+	notify.Lane = lane;
+
+	ScheduleUpdate();
+}
+
+void UJwRpcConnection::NotifyCoalesced(const FString& method, const FString& params, const FString& key, EJwRpcLane lane)
+{
+	FCoalescedNotify& notify = CoalescedNotifies.FindOrAdd(TPair<FString, FString>(method, key));
+	notify.Method = method;
+	notify.Params = nullptr;
+	notify.ParamsString = params;
+	notify.Lane = lane;
+
+	ScheduleUpdate();
+}
+
+void UJwRpcConnection::K2_NotifyCoalesced(const FString& method, const FJwRpcJson& params, const FString& key)
+{
+	if (params.Value)
+		NotifyCoalesced(method, params.Value, key);
+	else
+		NotifyCoalesced(method, TEXT("null"), key);
+}
+
+void UJwRpcConnection::SetCoalesceRate(float flushPerSecond)
+{
+	CoalesceInterval = flushPerSecond > 0 ? 1 / flushPerSecond : 0;
+	ScheduleUpdate();
+}
+
+void UJwRpcConnection::FlushCoalesced()
 {
-	return Notify(method, params ? HelperStringifyJSON(params) : FString());
+	//kept till we are connected, the latest state is still worth sending
+	if (CoalescedNotifies.Num() == 0 || !IsConnected())
+		return;
+
+	const float now = GetTime();
+	if (now < LastCoalesceFlushTime + CoalesceInterval)
+		return;
+
+	LastCoalesceFlushTime = now;
+
+	TMap<TPair<FString, FString>, FCoalescedNotify> flushed = MoveTemp(CoalescedNotifies);
+	CoalescedNotifies.Reset();
+
+	for (auto& pair : flushed)
+	{
+		const FCoalescedNotify& notify = pair.Value;
+		if (notify.Params)
+			Notify(notify.Method, notify.Params, notify.Lane);
+		else
+			Notify(notify.Method, notify.ParamsString, notify.Lane);
+	}
 }
 
 void UJwRpcConnection::K2_Notify(const FString& method, const FString& params)
@@ -97,7 +252,7 @@ void UJwRpcConnection::K2_Notify(const FString& method, const FString& params)
 	return Notify(method, params);
 }
 
-void UJwRpcConnection::K2_Request(const FString& method, const FString& params, FOnRPCResult onSuccess, FOnRPCError onError)
+FJwRpcRequestHandle UJwRpcConnection::K2_Request(const FString& method, const FString& params, FOnRPCResult onSuccess, FOnRPCError onError)
 {
 	return Request(method, params, FSuccessCB::CreateLambda([onSuccess](TSharedPtr<FJsonValue> result) {
 		//
@@ -115,13 +270,11 @@ void UJwRpcConnection::K2_NotifyJSON(const FString& method, const UJsonValue* pa
 	return Notify(method, params ? params->ToString(false) : FString());
 }
 
-void UJwRpcConnection::K2_RequestJSON(const FString& method, const UJsonValue* params, FOnRPCResultJSON onSuccess, FOnRPCError onError)
+FJwRpcRequestHandle UJwRpcConnection::K2_RequestJSON(const FString& method, const UJsonValue* params, FOnRPCResultJSON onSuccess, FOnRPCError onError)
 {
-	Request(method, params ? params->ToString(false) : FString(), FSuccessCB::CreateLambda([onSuccess](TSharedPtr<FJsonValue> result) {
+	return Request(method, params ? params->ToString(false) : FString(), FSuccessCB::CreateLambda([onSuccess](TSharedPtr<FJsonValue> result) {
 		//
-		UJsonValue* blueprinted = UJsonValue::MakeFromCPPVersion(result);
-		if (ensureAlways(blueprinted))
-			onSuccess.ExecuteIfBound(blueprinted);
+		onSuccess.ExecuteIfBound(FJwRpcJson(result));
 
 	}), FErrorCB::CreateLambda([onError](const FJwRPCError & err) {
 		//
@@ -182,15 +335,203 @@ bool UJwRpcConnection::IsConnecting() const
 	return bConnecting;
 }
 
-void UJwRpcConnection::Send(const FString& data)
+void UJwRpcConnection::Send(const FString& data, EJwRpcLane lane)
 {
 	if (Connection && Connection->IsConnected())
 	{
-		Connection->Send(data);
+		SendOnLane(data, GetLane(lane, FString()));
 		UE_LOG(LogJwRPC, Warning, TEXT("OutgingData:%s"), *data);
 	}
 }
 
+void UJwRpcConnection::WriteFrame(const FString& data)
+{
+	if (Recorder)
+		Recorder->Record(EJwRpcFrameDirection::Outgoing, data);
+
+	Connection->Send(data);
+}
+
+//budgets are in bytes as they are written, not characters
+static int64 GetWireSize(const FString& data)
+{
+	return FTCHARToUTF8(*data, data.Len()).Length();
+}
+
+void UJwRpcConnection::SendOnLane(const FString& data, EJwRpcLane lane, const TArray<FString>& requestIds, bool bBatch)
+{
+	check(lane != EJwRpcLane::ByMethod);
+
+	FLane& laneData = Lanes[(int)lane];
+	const int64 size = GetWireSize(data);
+
+	if (lane == EJwRpcLane::Realtime)
+	{
+		laneData.SentMessages++;
+		laneData.SentBytes += size;
+		WriteFrame(data);
+		return;
+	}
+
+	RefillLaneBudgets();
+
+	//messages can't overtake the queued ones of their own or higher priority lanes
+	bool bCanWrite = IsConnected() && (laneData.BytesPerTick <= 0 || laneData.Budget > 0);
+	for (int i = (int)EJwRpcLane::Normal; i <= (int)lane && bCanWrite; i++)
+		bCanWrite = !Lanes[i].HasQueued();
+
+	if (bCanWrite)
+	{
+		//unlimited lanes don't build up a deficit
+		if (laneData.BytesPerTick > 0)
+			laneData.Budget -= size;
+		laneData.SentMessages++;
+		laneData.SentBytes += size;
+		WriteFrame(data);
+		return;
+	}
+
+	FOutgoingFrame frame;
+	frame.Data = data;
+	frame.QueueTime = FPlatformTime::Seconds();
+	frame.Size = size;
+	frame.RequestIds = requestIds;
+	frame.bBatch = bBatch;
+	laneData.Queue.Add(MoveTemp(frame));
+	laneData.QueuedBytes += size;
+
+	ScheduleUpdate();
+}
+
+EJwRpcLane UJwRpcConnection::GetLane(EJwRpcLane lane, const FString& method) const
+{
+	if (lane != EJwRpcLane::ByMethod)
+		return lane;
+
+	const EJwRpcLane* pLane = MethodLanes.Find(method);
+	return pLane ? *pLane : EJwRpcLane::Normal;
+}
+
+void UJwRpcConnection::RefillLaneBudgets()
+{
+	if (LastRefillFrame == GFrameCounter)
+		return;
+
+	const int64 ticks = FMath::Max<int64>(1, GFrameCounter - LastRefillFrame);
+	LastRefillFrame = GFrameCounter;
+
+	//unused budget is not saved for later ticks, but the deficit of big messages is paid back
+	for (FLane& lane : Lanes)
+		lane.Budget = FMath::Min<int64>(lane.Budget + lane.BytesPerTick * ticks, lane.BytesPerTick);
+}
+
+void UJwRpcConnection::FlushLanes()
+{
+	if (!IsConnected())
+		return;
+
+	RefillLaneBudgets();
+
+	const double now = FPlatformTime::Seconds();
+
+	//strict priority, a lane is drained only if the higher ones are empty
+	for (int i = (int)EJwRpcLane::Normal; i < NumLanes; i++)
+	{
+		FLane& lane = Lanes[i];
+		while (lane.HasQueued() && (lane.BytesPerTick <= 0 || lane.Budget > 0))
+		{
+			FOutgoingFrame frame = MoveTemp(lane.Queue[lane.Head]);
+			lane.Head++;
+
+			const int64 size = frame.Size;
+			const float wait = (float)(now - frame.QueueTime);
+			lane.QueuedBytes -= size;
+			if (lane.BytesPerTick > 0)
+				lane.Budget -= size;
+			lane.SentMessages++;
+			lane.SentBytes += size;
+			lane.TotalWait += wait;
+			lane.WaitedMessages++;
+			lane.MaxWait = FMath::Max(lane.MaxWait, wait);
+
+			WriteFrame(frame.Data);
+		}
+
+		if (!lane.HasQueued())
+		{
+			lane.Queue.Reset();
+			lane.Head = 0;
+		}
+		else
+		{
+			//drop the sent items once they are the majority
+			if (lane.Head > lane.Queue.Num() / 2)
+			{
+				lane.Queue.RemoveAt(0, lane.Head, false);
+				lane.Head = 0;
+			}
+			break;
+		}
+	}
+}
+
+void UJwRpcConnection::ResetLanes()
+{
+	for (FLane& lane : Lanes)
+	{
+		lane.Queue.Reset();
+		lane.Head = 0;
+		lane.QueuedBytes = 0;
+	}
+}
+
+void UJwRpcConnection::SetMethodLane(const FString& method, EJwRpcLane lane)
+{
+	if (lane == EJwRpcLane::ByMethod)
+		MethodLanes.Remove(method);
+	else
+		MethodLanes.Add(method, lane);
+}
+
+void UJwRpcConnection::SetLaneBudget(EJwRpcLane lane, int bytesPerTick)
+{
+	if (lane == EJwRpcLane::Realtime || lane == EJwRpcLane::ByMethod)
+		return;
+
+	FLane& laneData = Lanes[(int)lane];
+	laneData.BytesPerTick = FMath::Max(0, bytesPerTick);
+	laneData.Budget = laneData.BytesPerTick;
+	ScheduleUpdate();
+}
+
+FJwRpcLaneStats UJwRpcConnection::GetLaneStats(EJwRpcLane lane) const
+{
+	FJwRpcLaneStats stats;
+	if (lane == EJwRpcLane::ByMethod)
+		return stats;
+
+	const FLane& laneData = Lanes[(int)lane];
+	stats.QueuedMessages = laneData.Queue.Num() - laneData.Head;
+	stats.QueuedBytes = laneData.QueuedBytes;
+	stats.OldestWait = laneData.HasQueued() ? (float)(FPlatformTime::Seconds() - laneData.Queue[laneData.Head].QueueTime) : 0;
+	stats.MaxWait = laneData.MaxWait;
+	stats.AverageWait = laneData.WaitedMessages ? (float)(laneData.TotalWait / laneData.WaitedMessages) : 0;
+	stats.SentMessages = laneData.SentMessages;
+	stats.SentBytes = laneData.SentBytes;
+	return stats;
+}
+
+bool UJwRpcConnection::StartCapture(const FString& filePath)
+{
+	Recorder = FJwRpcTrafficRecorder::Create(filePath);
+	return Recorder.IsValid();
+}
+
+void UJwRpcConnection::StopCapture()
+{
+	Recorder = nullptr;
+}
+
 void UJwRpcConnection::K2_IncomingRequestFinishError(const FJwRpcIncomingRequest& request, const FJwRPCError& error)
 {
 	request.FinishError(error);
@@ -207,6 +548,119 @@ void UJwRpcConnection::K2_IncomingRequestFinishSuccessJSON(const FJwRpcIncomingR
 		request.FinishSuccess(result->ToString(false));
 }
 
+void UJwRpcConnection::K2_IncomingRequestFinishSuccessHandle(const FJwRpcIncomingRequest& request, const FJwRpcJson& result)
+{
+	if (result.Value)
+		request.FinishSuccess(result.Value);
+	else
+		request.FinishSuccess(TEXT("null"));
+}
+
+bool UJwRpcConnection::K2_IsIncomingRequestCancelled(const FJwRpcIncomingRequest& request)
+{
+	return request.IsCancelled();
+}
+
+bool UJwRpcConnection::K2_CancelRequest(const FJwRpcRequestHandle& request, bool bNotifyPeer)
+{
+	return request.Cancel(bNotifyPeer);
+}
+
+bool UJwRpcConnection::CancelRequest(const FString& id, bool bNotifyPeer)
+{
+	FRequest removed;
+	if (!Requests.RemoveAndCopyValue(id, removed))
+		return false;
+
+	UE_LOG(LogJwRPC, Log, TEXT("request cancelled. id:%s method:%s"), *id, *removed.Method);
+
+	//not written yet, so the peer never hears of it
+	const int batchIndex = BatchRequestIds.Find(id);
+	if (batchIndex != INDEX_NONE)
+	{
+		BatchMessages.RemoveAt(batchIndex);
+		BatchRequestIds.RemoveAt(batchIndex);
+		return true;
+	}
+
+	EJwRpcLane queuedLane;
+	if (RemoveQueuedRequest(id, queuedLane))
+		return true;
+
+	//the respond may still arrive, we keep the id till it expires so that its not reported as unknown
+	CancelledRequests.Add(id, removed.ExpireTime);
+	ScheduleUpdate();
+
+	if (bNotifyPeer && IsConnected())
+	{
+		const FString params = FString::Printf(TEXT(R"({"id":"%s"})"), *id);
+		//a queued batch can't be split, the cancel waits behind it on the same lane
+		if (queuedLane != EJwRpcLane::ByMethod)
+			SendOnLane(FString::Printf(TEXT(R"({"method":"%s","params":%s})"), *CancelMethod, *params), queuedLane);
+		else
+			Notify(CancelMethod, params);
+	}
+
+	return true;
+}
+
+bool UJwRpcConnection::RemoveQueuedRequest(const FString& id, EJwRpcLane& outBatchLane)
+{
+	outBatchLane = EJwRpcLane::ByMethod;
+
+	for (int i = (int)EJwRpcLane::Normal; i < NumLanes; i++)
+	{
+		FLane& lane = Lanes[i];
+		for (int j = lane.Head; j < lane.Queue.Num(); j++)
+		{
+			FOutgoingFrame& frame = lane.Queue[j];
+			if (!frame.RequestIds.Contains(id))
+				continue;
+
+			if (frame.bBatch)
+			{
+				outBatchLane = (EJwRpcLane)i;
+				return false;
+			}
+
+			lane.QueuedBytes -= frame.Size;
+			lane.Queue.RemoveAt(j);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool UJwRpcConnection::IsRequestPending(const FString& id) const
+{
+	return Requests.Contains(id);
+}
+
+void UJwRpcConnection::AddRawMessageFilter(FRawMessageFilter filter)
+{
+	RawMessageFilters.Add(filter);
+}
+
+void UJwRpcConnection::RemoveRawMessageFilters(const void* owner)
+{
+	RawMessageFilters.RemoveAll([owner](const FRawMessageFilter& filter) {
+		return !filter.IsBound() || filter.IsBoundToObject(owner);
+	});
+}
+
+void UJwRpcConnection::AddCloseObserver(FOnClosed observer)
+{
+	CloseObservers.Add(observer);
+}
+
+void UJwRpcConnection::RemoveCloseObservers(const void* owner)
+{
+	CloseObservers.RemoveAll([owner](const FOnClosed& observer) {
+		return !observer.IsBound() || observer.IsBoundToObject(owner);
+	});
+}
+
 /*
 UJwRpcConnection* UJwRpcConnection::Connect(const FString& url, TFunction<void()> onSucess, TFunction<void(const FString&)> onError)
 {
@@ -235,7 +689,7 @@ void UJwRpcConnection::TryReconnect()
 	if (!Connection->IsConnected() && !bConnecting)
 	{
 		bConnecting = true;
-		LastConnectAttempTime = TimeSinceStart;
+		LastConnectAttempTime = GetTime();
 		Connection->Connect();
 	}
 }
@@ -245,27 +699,77 @@ UJwRpcConnection* UJwRpcConnection::CreateAndConnect(const FString& url, TSubcla
 	//UJwRpcConnection* pConn = NewObject<UJwRpcConnection>((UObject*)GetTransientPackage(), UJwRpcConnection::StaticClass());
 	UJwRpcConnection* pConn = NewObject<UJwRpcConnection>((UObject*)GetTransientPackage(), connectionClass, NAME_None, RF_Transient);
 
-	FWebSocketsModule& wsModule = FModuleManager::LoadModuleChecked<FWebSocketsModule>(TEXT("WebSockets"));
-	//FWebSocketsModule::Get() retuned null on no editor builds
-	TSharedRef<IWebSocket> wsc = wsModule.CreateWebSocket(url);
-
-	wsc->OnConnectionError().AddUObject(pConn, &UJwRpcConnection::InternalOnConnectionError);
-	wsc->OnConnected().AddUObject(pConn, &UJwRpcConnection::InternalOnConnect);
-	//#Note OnMessage must be binned before Connect()
-	wsc->OnMessage().AddUObject(pConn, &UJwRpcConnection::OnMessage);
-	wsc->OnClosed().AddUObject(pConn, &UJwRpcConnection::OnClosed);
-
 	pConn->SavedURL = url;
-	pConn->Connection = wsc;
+	pConn->Register();
+	pConn->CreateSocket();
 	pConn->bConnecting = true;
 	pConn->LastConnectAttempTime = 0;
 
 	UE_LOG(LogJwRPC, Log, TEXT("connecting to %s"), *url);
 
-	wsc->Connect();
+	pConn->Connection->Connect();
+	return pConn;
+}
+
+UJwRpcConnection* UJwRpcConnection::CreateWithSocket(TSharedRef<IWebSocket> socket, TSubclassOf<UJwRpcConnection> connectionClass)
+{
+	UJwRpcConnection* pConn = NewObject<UJwRpcConnection>((UObject*)GetTransientPackage(), connectionClass, NAME_None, RF_Transient);
+
+	pConn->Register();
+	pConn->BindSocket(socket);
+	pConn->bConnecting = true;
+	pConn->LastConnectAttempTime = 0;
+
+	socket->Connect();
 	return pConn;
 }
 
+void UJwRpcConnection::CreateSocket()
+{
+	//local sidecars may be reached by a plain tcp or unix socket instead
+	if (FJwRpcStreamSocket::IsStreamURL(SavedURL))
+	{
+		BindSocket(MakeShared<FJwRpcStreamSocket>(SavedURL));
+		return;
+	}
+
+	FWebSocketsModule& wsModule = FModuleManager::LoadModuleChecked<FWebSocketsModule>(TEXT("WebSockets"));
+	//FWebSocketsModule::Get() retuned null on no editor builds
+	BindSocket(wsModule.CreateWebSocket(SavedURL));
+}
+
+void UJwRpcConnection::BindSocket(TSharedRef<IWebSocket> wsc)
+{
+	wsc->OnConnectionError().AddUObject(this, &UJwRpcConnection::InternalOnConnectionError);
+	wsc->OnConnected().AddUObject(this, &UJwRpcConnection::InternalOnConnect);
+	//#Note OnMessage must be binned before Connect()
+	wsc->OnMessage().AddUObject(this, &UJwRpcConnection::OnMessage);
+	wsc->OnClosed().AddUObject(this, &UJwRpcConnection::OnClosed);
+
+	Connection = wsc;
+}
+
+void UJwRpcConnection::DropSocket(int32 StatusCode, const FString& Reason)
+{
+	if (Connection)
+	{
+		//we don't want to hear from the dead socket anymore
+		Connection->OnConnectionError().RemoveAll(this);
+		Connection->OnConnected().RemoveAll(this);
+		Connection->OnMessage().RemoveAll(this);
+		Connection->OnClosed().RemoveAll(this);
+		Connection->Close(4000, Reason);
+
+		//a connection made over a given socket has no url to create a new one
+		if (SavedURL.IsEmpty())
+			Connection = nullptr;
+		else
+			CreateSocket();
+	}
+
+	OnClosed(StatusCode, Reason, false);
+}
+
 void UJwRpcConnection::OnConnected(bool bReconnect)
 {
 	UE_LOG(LogJwRPC, Log, TEXT("UJwRpcConnection::OnConnected bReconnect:%d"), bReconnect);
@@ -278,11 +782,13 @@ void UJwRpcConnection::OnConnectionError(const FString& error, bool bReconnect)
 {
 	UE_LOG(LogJwRPC, Error, TEXT("UJwRpcConnection::OnConnectionError Error:%s bReconnect:%d"), *error, bReconnect);
 
-	LastConnectionErrorTime = TimeSinceStart;
+	LastConnectionErrorTime = GetTime();
 	bConnecting = false;
 
 	OnConnectionErrorEvent.ExecuteIfBound(error, bReconnect);
 	K2_OnConnectionError(error, bReconnect);
+
+	ScheduleUpdate();
 }
 
 //UJwRpcConnection* UJwRpcConnection::K2_Connect(const FString& url, FOnConnectSuccess onSucess, FOnConnectFailed onError)
@@ -299,6 +805,26 @@ void UJwRpcConnection::BeginDestroy()
 	Super::BeginDestroy();
 
 	Close(1001);
+
+	if (bRegistered)
+	{
+		if (UJwRpcSubsystem* pSubsystem = UJwRpcSubsystem::Get())
+			pSubsystem->Unregister(this);
+		bRegistered = false;
+	}
+}
+
+void UJwRpcConnection::Register()
+{
+	UJwRpcSubsystem* pSubsystem = UJwRpcSubsystem::Get();
+	if (!pSubsystem)
+	{
+		UE_LOG(LogJwRPC, Warning, TEXT("JwRPC subsystem is not available, the connection won't be updated"));
+		return;
+	}
+
+	pSubsystem->Register(this);
+	bRegistered = true;
 }
 
 FString UJwRpcConnection::GenId()
@@ -322,22 +848,79 @@ FJwRPCError JsonToJwError(TSharedPtr<FJsonObject> js)
 
 void UJwRpcConnection::OnMessage(const FString& data)
 {
-	static FString STR_error("error");
-	static FString STR_method("method");
-	static FString STR_id("id");
-	static FString STR_result("result");
-
 	UE_LOG(LogJwRPC, Warning, TEXT("UJwRpcConnection::OnMessage:%s"), *data);
 
-	TSharedPtr<FJsonObject> JsonObject;
-	TSharedRef<TJsonReader<>> JsonReader = TJsonReaderFactory<>::Create(data);
-	if (!FJsonSerializer::Deserialize(JsonReader, JsonObject) || !JsonObject.IsValid())
+	if (Recorder)
+		Recorder->Record(EJwRpcFrameDirection::Incoming, data);
+
+	for (int i = 0; i < RawMessageFilters.Num(); i++)
 	{
-		UE_LOG(LogJwRPC, Error, TEXT("failed to deserialize JSON"));
-		return;
+		if (RawMessageFilters[i].IsBound() && RawMessageFilters[i].Execute(data))
+		{
+			MissedHeartbeats = 0;
+			return;
+		}
 	}
 
-	if (JsonObject->HasField(STR_method)) //is it request?
+	//a JSON-RPC batch. e.g the responds of RequestAll
+	int32 firstChar = 0;
+	while (firstChar < data.Len() && FChar::IsWhitespace(data[firstChar]))
+		firstChar++;
+
+	if (firstChar < data.Len() && data[firstChar] == TCHAR('['))
+	{
+		TArray<TSharedPtr<FJsonValue>> batch;
+		TSharedRef<TJsonReader<>> JsonReader = TJsonReaderFactory<>::Create(data);
+		if (!FJsonSerializer::Deserialize(JsonReader, batch))
+		{
+			UE_LOG(LogJwRPC, Error, TEXT("failed to deserialize JSON"));
+			return;
+		}
+
+		MissedHeartbeats = 0;
+
+		//the responds to its requests are written as one array. a handler may feed us another message
+		TSharedPtr<FJwRpcIncomingBatch> outerBatch = IncomingBatch;
+		TSharedPtr<FJwRpcIncomingBatch> incomingBatch = MakeShared<FJwRpcIncomingBatch>();
+		IncomingBatch = incomingBatch;
+
+		for (const TSharedPtr<FJsonValue>& item : batch)
+		{
+			const TSharedPtr<FJsonObject>* pObject = nullptr;
+			if (item.IsValid() && item->TryGetObject(pObject))
+				DispatchMessage(*pObject);
+		}
+
+		IncomingBatch = outerBatch;
+		//written now if its requests are all finished already
+		incomingBatch->bDispatched = true;
+		incomingBatch->Remaining++;
+		ReleaseBatchItem(incomingBatch);
+		return;
+	}
+
+	TSharedPtr<FJsonObject> JsonObject;
+	TSharedRef<TJsonReader<>> JsonReader = TJsonReaderFactory<>::Create(data);
+	if (!FJsonSerializer::Deserialize(JsonReader, JsonObject) || !JsonObject.IsValid())
+	{
+		UE_LOG(LogJwRPC, Error, TEXT("failed to deserialize JSON"));
+		return;
+	}
+
+	//any message from the peer proves the connection is alive
+	MissedHeartbeats = 0;
+
+	DispatchMessage(JsonObject);
+}
+
+void UJwRpcConnection::DispatchMessage(const TSharedPtr<FJsonObject>& JsonObject)
+{
+	static FString STR_error("error");
+	static FString STR_method("method");
+	static FString STR_id("id");
+	static FString STR_result("result");
+
+	if (JsonObject->HasField(STR_method)) //is it request?
 	{
 		OnRequestRecv(JsonObject);
 	}
@@ -347,11 +930,18 @@ void UJwRpcConnection::OnMessage(const FString& data)
 		FRequest* pRequest = Requests.Find(id);
 		if (!pRequest)
 		{
+			if (CancelledRequests.Remove(id))
+			{
+				UE_LOG(LogJwRPC, Verbose, TEXT("ignored respond of cancelled request. id:%s"), *id);
+				return;
+			}
+
 			UE_LOG(LogJwRPC, Error, TEXT("request with id:%s not found"), *id);
 			return;
 		}
 
 		FRequest requestCopied = *pRequest;
+		Latencies.FindOrAdd(requestCopied.Method).Add((float)(FPlatformTime::Seconds() - requestCopied.SendTime));
 
 		if (JsonObject->HasField(STR_error)) //is it error respond?
 		{
@@ -380,9 +970,14 @@ void UJwRpcConnection::InternalOnConnect()
 {
 	bConnecting = false;
 	ReconnectAttempt = 0;
+	MissedHeartbeats = 0;
+	bHeartbeatInFlight = false;
+	LastHeartbeatTime = GetTime();
 
 	OnConnected(!bFirstConnect);
 	bFirstConnect = false;
+
+	ScheduleUpdate();
 }
 
 void UJwRpcConnection::InternalOnConnectionError(const FString& error)
@@ -394,83 +989,308 @@ void UJwRpcConnection::OnClosed(int32 StatusCode, const FString& Reason, bool bW
 {
 	UE_LOG(LogJwRPC, Log, TEXT("UJwRpcConnection::OnClosed StatusCode:%d Reason:%s bWasClean:%d"), StatusCode, *Reason, bWasClean);
 
-	LastDisconnectTime = TimeSinceStart;
+	LastDisconnectTime = GetTime();
 	bConnecting = false;
 
 	KillAll(FJwRPCError::NoConnection);
+	CancelAllIncoming();
+	ResetLanes();
+
+	//observers may remove themselves
+	const TArray<FOnClosed> observers = CloseObservers;
+	for (const FOnClosed& observer : observers)
+		observer.ExecuteIfBound(StatusCode, Reason, bWasClean);
 
 	OnClosedEvent.ExecuteIfBound(StatusCode, Reason, bWasClean);
 	K2_OnClosed(StatusCode, Reason, bWasClean);
 
+	ScheduleUpdate();
+
 	
 }
 
 void UJwRpcConnection::KillAll(const FJwRPCError& error)
 {
-	for (auto& pair : Requests)
+	//callbacks may send new requests, so the table must not be iterated while they run
+	TMap<FString, FRequest> killed = MoveTemp(Requests);
+	Requests.Reset();
+	CancelledRequests.Reset();
+
+	for (auto& pair : killed)
 	{
 		pair.Value.OnError.ExecuteIfBound(error);
 	}
-
-	Requests.Reset();
 }
 
 void UJwRpcConnection::CheckExpiredRequests()
 {
-	auto elapsed = TimeSinceStart - LastExpireCheckTime;
-	if (elapsed < 2)
+	const float now = GetTime();
+	if (now < NextExpireTime)
 		return;
 
-	LastExpireCheckTime = TimeSinceStart;
+	NextExpireTime = MAX_flt;
+
+	for (auto iter = CancelledRequests.CreateIterator(); iter; ++iter)
+	{
+		if (now >= iter.Value())
+			iter.RemoveCurrent();
+		else
+			NextExpireTime = FMath::Min(NextExpireTime, iter.Value());
+	}
 
-	static TArray<FString> expired;
-	expired.Reset();
+	//callbacks may send new requests or drop the connection, so they are called after the table is updated
+	TArray<FRequest> expired;
 
-	for (auto& pair : Requests)
+	for (auto iter = Requests.CreateIterator(); iter; ++iter)
 	{
-		if (TimeSinceStart > pair.Value.ExpireTime)
+		if (now >= iter.Value().ExpireTime)
 		{
-			expired.Add(pair.Key);
-			UE_LOG(LogJwRPC, Log, TEXT("request timed out. id:%s"), *pair.Key);
-			pair.Value.OnError.ExecuteIfBound(FJwRPCError::Timeout);
+			UE_LOG(LogJwRPC, Log, TEXT("request timed out. id:%s"), *iter.Key());
+			expired.Add(MoveTemp(iter.Value()));
+			iter.RemoveCurrent();
+		}
+		else
+		{
+			NextExpireTime = FMath::Min(NextExpireTime, iter.Value().ExpireTime);
 		}
 	}
 
-	for (const FString& id : expired)
-		Requests.Remove(id);
+	for (const FRequest& req : expired)
+		req.OnError.ExecuteIfBound(FJwRPCError::Timeout);
 
+}
 
+float UJwRpcConnection::GetTime()
+{
+	return (float)(FPlatformTime::Seconds() - GStartTime);
 }
 
-void UJwRpcConnection::Tick(float DeltaTime)
+bool UJwRpcConnection::ShouldReconnect() const
 {
-	TimeSinceStart += DeltaTime;
+	//if have connection but its disconnected we try to reconnect
+	return Connection && !Connection->IsConnected() && !bConnecting && bAutoReconnectEnabled && LastDisconnectTime != 0 && ReconnectAttempt < ReconnectMaxAttempt;
+}
 
+void UJwRpcConnection::Update()
+{
+	if (ShouldReconnect())
 	{
-		//if have connection but its disconnected we try to reconnect
-		if (Connection && !Connection->IsConnected() && !bConnecting && bAutoReconnectEnabled && LastDisconnectTime != 0)
+		auto elapsed = GetTime() - LastConnectionErrorTime;
+		if (elapsed > ReconnectDelay)
 		{
-			auto elapsed = TimeSinceStart - LastConnectionErrorTime;
-			if (elapsed > ReconnectDelay && ReconnectAttempt < ReconnectMaxAttempt)
-			{
-				ReconnectAttempt++;
-				TryReconnect();
-			}
+			ReconnectAttempt++;
+			TryReconnect();
 		}
-
 	}
 
+	FlushCoalesced();
+	FlushLanes();
+	TickHeartbeat();
 	CheckExpiredRequests();
+	ExpireQueuedRequests();
+
+	ScheduleUpdate();
 }
 
-bool UJwRpcConnection::IsTickable() const
+float UJwRpcConnection::GetNextUpdateTime() const
 {
-	return !IsTemplate();
+	float wakeTime = MAX_flt;
+
+	if (ShouldReconnect())
+		wakeTime = LastConnectionErrorTime + ReconnectDelay;
+
+	if (Requests.Num() || CancelledRequests.Num())
+		wakeTime = FMath::Min(wakeTime, NextExpireTime);
+
+	if (HeartbeatInterval > 0 && !bHeartbeatInFlight && IsConnected())
+		wakeTime = FMath::Min(wakeTime, LastHeartbeatTime + HeartbeatInterval);
+
+	//queued requests are released by the completion of the running ones, we only wake to expire them
+	if (NumQueuedRequests)
+		wakeTime = FMath::Min(wakeTime, NextQueueDeadline);
+
+	if (CoalescedNotifies.Num() && IsConnected())
+		wakeTime = FMath::Min(wakeTime, LastCoalesceFlushTime + CoalesceInterval);
+
+	const float now = GetTime();
+
+	//queued messages are written in the next ticks as the budget allows
+	for (const FLane& lane : Lanes)
+	{
+		if (lane.HasQueued() && IsConnected())
+			wakeTime = FMath::Min(wakeTime, now);
+	}
+
+	//overdue wakes are served in the order of their deadline, but never ahead of the ones that are due now
+	if (wakeTime != MAX_flt)
+		wakeTime = FMath::Max(wakeTime, now);
+
+	return wakeTime;
 }
 
-TStatId UJwRpcConnection::GetStatId() const
+void UJwRpcConnection::ScheduleUpdate()
 {
-	return TStatId();
+	const float wakeTime = GetNextUpdateTime();
+	//idle, nothing to do till something happens
+	if (wakeTime == MAX_flt)
+		return;
+
+	//a wake up that comes too early just schedules the next one
+	if (bWakeScheduled && wakeTime >= ScheduledWakeTime)
+		return;
+
+	if (UJwRpcSubsystem* pSubsystem = UJwRpcSubsystem::Get())
+	{
+		bWakeScheduled = true;
+		ScheduledWakeTime = wakeTime;
+		pSubsystem->Schedule(this, wakeTime, ++WakeSerial);
+	}
+}
+
+void UJwRpcConnection::TickHeartbeat()
+{
+	if (HeartbeatInterval <= 0 || bHeartbeatInFlight || !IsConnected())
+		return;
+
+	if (GetTime() - LastHeartbeatTime < HeartbeatInterval)
+		return;
+
+	LastHeartbeatTime = GetTime();
+	bHeartbeatInFlight = true;
+
+	const double sendTime = FPlatformTime::Seconds();
+	//realtime, so the RTT doesn't include time spent in our queues
+	FJwRpcRequestHandle handle = Request(HeartbeatMethod, TEXT("{}"),
+		FSuccessCB::CreateUObject(this, &UJwRpcConnection::OnHeartbeatResult, sendTime),
+		FErrorCB::CreateUObject(this, &UJwRpcConnection::OnHeartbeatError, sendTime), EJwRpcLane::Realtime);
+
+	//heartbeat must not wait for the default timeout
+	if (FRequest* pReq = Requests.Find(handle.Id))
+	{
+		pReq->ExpireTime = GetTime() + HeartbeatInterval;
+		NextExpireTime = FMath::Min(NextExpireTime, pReq->ExpireTime);
+	}
+}
+
+void UJwRpcConnection::OnHeartbeatResult(TSharedPtr<FJsonValue> result, double sendTime)
+{
+	bHeartbeatInFlight = false;
+	ScheduleUpdate();
+	MissedHeartbeats = 0;
+	AddRTTSample(FPlatformTime::Seconds() - sendTime);
+}
+
+void UJwRpcConnection::OnHeartbeatError(const FJwRPCError& error, double sendTime)
+{
+	bHeartbeatInFlight = false;
+	ScheduleUpdate();
+
+	if (error.Code == FJwRPCError::NoConnection.Code)
+		return;
+
+	if (error.Code != FJwRPCError::Timeout.Code)
+	{
+		//any respond, even an error one, proves the peer is alive
+		OnHeartbeatResult(nullptr, sendTime);
+		return;
+	}
+
+	MissedHeartbeats++;
+	UE_LOG(LogJwRPC, Warning, TEXT("heartbeat timed out. missed:%d"), MissedHeartbeats);
+
+	if (MissedHeartbeats >= HeartbeatMaxMissed)
+	{
+		UE_LOG(LogJwRPC, Error, TEXT("peer is not responding, dropping the connection"));
+		MissedHeartbeats = 0;
+		DropSocket(1006, TEXT("heartbeat timeout"));
+	}
+}
+
+void UJwRpcConnection::AddRTTSample(double rtt)
+{
+	//same as TCP's SRTT/RTTVAR. RFC 6298
+	const float sample = (float)rtt;
+	if (SmoothedRTT < 0)
+	{
+		SmoothedRTT = sample;
+		RTTVariance = sample / 2;
+	}
+	else
+	{
+		RTTVariance = 0.75f * RTTVariance + 0.25f * FMath::Abs(SmoothedRTT - sample);
+		SmoothedRTT = 0.875f * SmoothedRTT + 0.125f * sample;
+	}
+}
+
+float UJwRpcConnection::GetRequestTimeout(const FString& method) const
+{
+	if (!bAdaptiveTimeout)
+		return DefaultTimeout;
+
+	const FLatencyHistory* pHistory = Latencies.Find(method);
+	if (!pHistory || pHistory->Samples.Num() < MinAdaptiveSamples)
+		return DefaultTimeout;
+
+	float timeout = pHistory->Percentile(AdaptiveTimeoutPercentile) * AdaptiveTimeoutScale;
+	if (SmoothedRTT >= 0)
+		timeout = FMath::Max(timeout, SmoothedRTT + 4 * RTTVariance);
+
+	return FMath::Clamp(timeout, AdaptiveTimeoutMin, DefaultTimeout);
+}
+
+void UJwRpcConnection::SetHeartbeat(float interval, int maxMissed)
+{
+	HeartbeatInterval = interval;
+	HeartbeatMaxMissed = FMath::Max(1, maxMissed);
+	ScheduleUpdate();
+}
+
+void UJwRpcConnection::SetAdaptiveTimeout(bool bEnable, float percentile, float scale, float minTimeout)
+{
+	bAdaptiveTimeout = bEnable;
+	AdaptiveTimeoutPercentile = FMath::Clamp(percentile, 0.0f, 1.0f);
+	AdaptiveTimeoutScale = FMath::Max(1.0f, scale);
+	AdaptiveTimeoutMin = FMath::Max(0.0f, minTimeout);
+}
+
+float UJwRpcConnection::GetSmoothedRTT() const
+{
+	return SmoothedRTT;
+}
+
+float UJwRpcConnection::GetRTTVariance() const
+{
+	return RTTVariance;
+}
+
+float UJwRpcConnection::GetLatencyPercentile(const FString& method, float percentile) const
+{
+	const FLatencyHistory* pHistory = Latencies.Find(method);
+	return pHistory ? pHistory->Percentile(percentile) : -1;
+}
+
+void UJwRpcConnection::FLatencyHistory::Add(float seconds)
+{
+	if (Samples.Num() < MaxSamples)
+	{
+		Samples.Add(seconds);
+	}
+	else
+	{
+		Samples[Next] = seconds;
+		Next = (Next + 1) % MaxSamples;
+	}
+}
+
+float UJwRpcConnection::FLatencyHistory::Percentile(float p) const
+{
+	if (Samples.Num() == 0)
+		return -1;
+
+	TArray<float, TInlineAllocator<MaxSamples>> sorted(Samples);
+	sorted.Sort();
+	const int index = FMath::Clamp(FMath::CeilToInt(p * sorted.Num()) - 1, 0, sorted.Num() - 1);
+	return sorted[index];
 }
 
 void UJwRpcConnection::OnRequestRecv(TSharedPtr<FJsonObject> root)
@@ -481,6 +1301,20 @@ void UJwRpcConnection::OnRequestRecv(TSharedPtr<FJsonObject> root)
 
 	FString method = root->GetStringField(STR_method);
 
+	if (method == CancelMethod)
+	{
+		OnCancelRecv(root->TryGetField(STR_params));
+		return;
+	}
+
+	//answer heartbeats of the peer unless user wants to handle them
+	if (method == HeartbeatMethod && !RegisteredCallbacks.Contains(method))
+	{
+		FString id;
+		if (root->TryGetStringField(STR_id, id))
+			SendRespond(FString::Printf(TEXT(R"({"id":"%s","result":true})"), *id), EJwRpcLane::Realtime, IncomingBatch);
+		return;
+	}
 
 	const FMethodData* pInfo = RegisteredCallbacks.Find(method);
 	if (!pInfo)
@@ -497,7 +1331,7 @@ void UJwRpcConnection::OnRequestRecv(TSharedPtr<FJsonObject> root)
 		}
 		else
 		{
-			pInfo->BPNotifyCB.ExecuteIfBound(this, UJsonValue::MakeFromCPPVersion(root->TryGetField(STR_params)));
+			pInfo->BPNotifyCB.ExecuteIfBound(this, FJwRpcJson(root->TryGetField(STR_params)));
 		}
 	}
 	else
@@ -505,28 +1339,342 @@ void UJwRpcConnection::OnRequestRecv(TSharedPtr<FJsonObject> root)
 		FJwRpcIncomingRequest incReq;
 		incReq.Connection = this;
 		incReq.Id = root->GetStringField(STR_id);
+		incReq.State = MakeShared<FJwRpcIncomingRequestState>();
+		incReq.State->Method = method;
+		incReq.State->Batch = IncomingBatch;
+		if (IncomingBatch)
+			IncomingBatch->Remaining++;
+
+		IncomingRequests.Add(incReq.Id, incReq.State);
 
-		if (pInfo->RequestCB.IsBound())
+		AdmitRequest(root, incReq);
+	}
+
+}
+
+void UJwRpcConnection::AdmitRequest(TSharedPtr<FJsonObject> root, FJwRpcIncomingRequest& incReq)
+{
+	float deadline = MAX_flt;
+	double callerWait = 0;
+	if (!DeadlineField.IsEmpty() && root->TryGetNumberField(DeadlineField, callerWait))
+	{
+		if (callerWait <= 0)
 		{
-			pInfo->RequestCB.Execute(root->TryGetField(STR_params), incReq);
+			UE_LOG(LogJwRPC, Warning, TEXT("incoming request id:%s rejected, deadline exceeded"), *incReq.Id);
+			incReq.FinishError(FJwRPCError::Overloaded.Code, TEXT("overloaded: deadline exceeded"));
+			return;
 		}
-		else
+		deadline = GetTime() + callerWait;
+	}
+
+	FMethodLimits* pLimits = RequestLimits.Find(incReq.State->Method);
+	if (!pLimits || pLimits->MaxConcurrent <= 0 || (pLimits->Running < pLimits->MaxConcurrent && pLimits->Queue.Num() == 0))
+	{
+		if (pLimits)
+			pLimits->Running++;
+
+		incReq.State->bAdmitted = true;
+		DispatchRequest(root, incReq);
+		return;
+	}
+
+	if (pLimits->Queue.Num() >= pLimits->MaxQueued)
+	{
+		UE_LOG(LogJwRPC, Warning, TEXT("incoming request id:%s method:%s rejected, queue is full"), *incReq.Id, *incReq.State->Method);
+		incReq.FinishError(FJwRPCError::Overloaded.Code, TEXT("overloaded: too many pending requests"));
+		return;
+	}
+
+	FQueuedRequest queued;
+	queued.Root = root;
+	queued.Handle = incReq;
+	queued.Deadline = FMath::Min(deadline, GetTime() + pLimits->MaxQueueWait);
+	NextQueueDeadline = FMath::Min(NextQueueDeadline, queued.Deadline);
+	pLimits->Queue.Add(MoveTemp(queued));
+	NumQueuedRequests++;
+	ScheduleUpdate();
+}
+
+void UJwRpcConnection::DispatchRequest(TSharedPtr<FJsonObject> root, FJwRpcIncomingRequest& incReq)
+{
+	static FString STR_params("params");
+
+	const FMethodData* pInfo = RegisteredCallbacks.Find(incReq.State->Method);
+	if (!pInfo)
+	{
+		//unregistered while the request was queued
+		UE_LOG(LogJwRPC, Warning, TEXT("no callback is registered for method '%s'"), *incReq.State->Method);
+		incReq.FinishError(FJwRPCError::MethodNotFound);
+		return;
+	}
+
+	if (pInfo->RequestCB.IsBound())
+	{
+		pInfo->RequestCB.Execute(root->TryGetField(STR_params), incReq);
+	}
+	else
+	{
+		pInfo->BPRequestCB.ExecuteIfBound(this, FJwRpcJson(root->TryGetField(STR_params)), incReq);
+	}
+}
+
+void UJwRpcConnection::PumpRequestQueue(const FString& method)
+{
+	FMethodLimits* pLimits = RequestLimits.Find(method);
+	//the handler may finish synchronously and get us here again, the outer loop takes care of it
+	if (!pLimits || pLimits->bPumping)
+		return;
+
+	pLimits->bPumping = true;
+
+	//0 means unlimited, e.g the limit was removed while requests were waiting
+	while (pLimits->Queue.Num() && (pLimits->MaxConcurrent <= 0 || pLimits->Running < pLimits->MaxConcurrent))
+	{
+		FQueuedRequest queued = pLimits->Queue[0];
+		pLimits->Queue.RemoveAt(0, 1, false);
+		NumQueuedRequests--;
+
+		if (queued.Handle.IsCancelled())
+		{
+			RemoveIncomingRequest(queued.Handle);
+			ReleaseBatchItem(queued.Handle.State->Batch);
+			continue;
+		}
+
+		if (GetTime() > queued.Deadline)
+		{
+			queued.Handle.FinishError(FJwRPCError::Overloaded.Code, TEXT("overloaded: deadline exceeded"));
+			continue;
+		}
+
+		pLimits->Running++;
+		queued.Handle.State->bAdmitted = true;
+		DispatchRequest(queued.Root, queued.Handle);
+
+		//dispatching may have added new limits and reallocated the map
+		pLimits = RequestLimits.Find(method);
+	}
+
+	pLimits->bPumping = false;
+}
+
+void UJwRpcConnection::ExpireQueuedRequests()
+{
+	const float now = GetTime();
+	if (NumQueuedRequests == 0 || now < NextQueueDeadline)
+		return;
+
+	NextQueueDeadline = MAX_flt;
+	TArray<FJwRpcIncomingRequest> expired;
+	TArray<FJwRpcIncomingRequest> cancelled;
+
+	for (auto& pair : RequestLimits)
+	{
+		pair.Value.Queue.RemoveAll([this, now, &expired, &cancelled](const FQueuedRequest& queued) {
+			if (queued.Handle.IsCancelled())
+			{
+				RemoveIncomingRequest(queued.Handle);
+				cancelled.Add(queued.Handle);
+				return true;
+			}
+			if (now >= queued.Deadline)
+			{
+				expired.Add(queued.Handle);
+				return true;
+			}
+			NextQueueDeadline = FMath::Min(NextQueueDeadline, queued.Deadline);
+			return false;
+		});
+	}
+
+	NumQueuedRequests = 0;
+	for (auto& pair : RequestLimits)
+		NumQueuedRequests += pair.Value.Queue.Num();
+
+	for (const FJwRpcIncomingRequest& incReq : cancelled)
+		ReleaseBatchItem(incReq.State->Batch);
+
+	for (const FJwRpcIncomingRequest& incReq : expired)
+	{
+		UE_LOG(LogJwRPC, Warning, TEXT("incoming request id:%s method:%s expired in queue"), *incReq.Id, *incReq.State->Method);
+		incReq.FinishError(FJwRPCError::Overloaded.Code, TEXT("overloaded: deadline exceeded"));
+	}
+}
+
+void UJwRpcConnection::SetRequestLimits(const FString& method, int maxConcurrent, int maxQueued, float maxQueueWait)
+{
+	FMethodLimits& limits = RequestLimits.FindOrAdd(method);
+	limits.MaxConcurrent = maxConcurrent;
+	limits.MaxQueued = FMath::Max(0, maxQueued);
+	limits.MaxQueueWait = FMath::Max(0.0f, maxQueueWait);
+
+	//the newest requests that don't fit the smaller queue are rejected
+	TArray<FJwRpcIncomingRequest> rejected;
+	const int maxWaiting = limits.MaxConcurrent <= 0 ? MAX_int32 : limits.MaxQueued;
+	while (limits.Queue.Num() > maxWaiting)
+	{
+		rejected.Add(limits.Queue.Last().Handle);
+		limits.Queue.RemoveAt(limits.Queue.Num() - 1, 1, false);
+		NumQueuedRequests--;
+	}
+
+	PumpRequestQueue(method);
+
+	for (const FJwRpcIncomingRequest& incReq : rejected)
+	{
+		if (incReq.IsCancelled())
 		{
-			pInfo->BPRequestCB.ExecuteIfBound(this, UJsonValue::MakeFromCPPVersion(root->TryGetField(STR_params)), incReq);
+			RemoveIncomingRequest(incReq);
+			ReleaseBatchItem(incReq.State->Batch);
 		}
+		else
+			incReq.FinishError(FJwRPCError::Overloaded.Code, TEXT("overloaded: too many pending requests"));
+	}
+}
+
+void UJwRpcConnection::SetRequestDeadlineField(const FString& field)
+{
+	DeadlineField = field;
+}
+
+void UJwRpcConnection::OnCancelRecv(TSharedPtr<FJsonValue> params)
+{
+	static FString STR_id("id");
+
+	const TSharedPtr<FJsonObject>* pParamsObject = nullptr;
+	if (!params || !params->TryGetObject(pParamsObject))
+	{
+		UE_LOG(LogJwRPC, Warning, TEXT("invalid params for '%s'"), *CancelMethod);
+		return;
+	}
+
+	//the entry stays in the table till the handler finishes so that its concurrency slot is released
+	const FString id = (*pParamsObject)->GetStringField(STR_id);
+	if (TSharedPtr<FJwRpcIncomingRequestState>* pState = IncomingRequests.Find(id))
+	{
+		UE_LOG(LogJwRPC, Log, TEXT("incoming request cancelled by peer. id:%s method:%s"), *id, *(*pState)->Method);
+		(*pState)->bCancelled = true;
+	}
+}
+
+bool UJwRpcConnection::RemoveIncomingRequest(const FJwRpcIncomingRequest& request)
+{
+	//the id alone is not enough, the peer may reuse it once the request it sent before is answered
+	const TSharedPtr<FJwRpcIncomingRequestState>* pState = IncomingRequests.Find(request.Id);
+	if (!pState || *pState != request.State)
+		return false;
+
+	IncomingRequests.Remove(request.Id);
+	return true;
+}
+
+void UJwRpcConnection::OnIncomingRequestFinished(const FJwRpcIncomingRequest& request)
+{
+	//requests that are not in the table belong to a previous connection
+	if (!RemoveIncomingRequest(request) || !request.State->bAdmitted)
+		return;
+
+	if (FMethodLimits* pLimits = RequestLimits.Find(request.State->Method))
+	{
+		pLimits->Running = FMath::Max(0, pLimits->Running - 1);
+		PumpRequestQueue(request.State->Method);
 	}
+}
 
+void UJwRpcConnection::SendRespond(const FString& data, EJwRpcLane lane, const TSharedPtr<FJwRpcIncomingBatch>& batch)
+{
+	if (!batch)
+	{
+		Send(data, lane);
+		return;
+	}
+
+	batch->Responds.Add(data);
+	batch->Lane = FMath::Min(batch->Lane, lane);
+}
+
+void UJwRpcConnection::ReleaseBatchItem(const TSharedPtr<FJwRpcIncomingBatch>& batch)
+{
+	if (!batch || --batch->Remaining > 0 || !batch->bDispatched)
+		return;
+
+	//notifications and cancelled requests have no respond, the peer gets nothing if they are all it sent
+	if (batch->bDropped || batch->Responds.Num() == 0)
+		return;
+
+	const FString data = TEXT("[") + FString::Join(batch->Responds, TEXT(",")) + TEXT("]");
+	batch->Responds.Reset();
+	Send(data, batch->Lane);
+}
+
+void UJwRpcConnection::CancelAllIncoming()
+{
+	for (auto& pair : IncomingRequests)
+	{
+		pair.Value->bCancelled = true;
+		if (pair.Value->Batch)
+			pair.Value->Batch->bDropped = true;
+	}
+
+	IncomingRequests.Reset();
+
+	for (auto& pair : RequestLimits)
+	{
+		pair.Value.Running = 0;
+		pair.Value.Queue.Reset();
+	}
+	NumQueuedRequests = 0;
+}
+
+bool FJwRpcRequestHandle::IsPending() const
+{
+	UJwRpcConnection* pConn = Connection.Get();
+	return pConn && pConn->IsRequestPending(Id);
+}
+
+bool FJwRpcRequestHandle::Cancel(bool bNotifyPeer) const
+{
+	UJwRpcConnection* pConn = Connection.Get();
+	return pConn && pConn->CancelRequest(Id, bNotifyPeer);
+}
+
+bool FJwRpcIncomingRequest::IsCancelled() const
+{
+	return State && State->bCancelled;
+}
+
+bool FJwRpcIncomingRequest::MarkFinished() const
+{
+	if (!State)
+		return true;
+
+	if (State->bFinished)
+	{
+		UE_LOG(LogJwRPC, Warning, TEXT("incoming request id:%s is already finished"), *Id);
+		return false;
+	}
+
+	State->bFinished = true;
+	if (UJwRpcConnection* pConn = Connection.Get())
+		pConn->OnIncomingRequestFinished(*this);
+
+	return true;
 }
 
 void FJwRpcIncomingRequest::FinishError(const FJwRPCError& error) const
 {
+	if (!MarkFinished())
+		return;
+
 	UJwRpcConnection* pConn = Connection.Get();
 	if(pConn && pConn->IsConnected())
 	{
 		const FString finalData = FString::Printf(TEXT(R"({"id":"%s","error":{"code":%d,"message":"%s"}})"), *Id, error.Code, *error.Message);
-		Connection-> Send(finalData);
-		
+		pConn->SendRespond(finalData, pConn->GetLane(EJwRpcLane::ByMethod, State ? State->Method : FString()), State ? State->Batch : nullptr);
 	}
+
+	if (pConn && State)
+		pConn->ReleaseBatchItem(State->Batch);
 }
 
 
@@ -544,16 +1692,31 @@ void FJwRpcIncomingRequest::FinishSuccess(TSharedPtr<FJsonValue> result) const
 
 void FJwRpcIncomingRequest::FinishSuccess(const FString& result) const
 {
+	if (!MarkFinished())
+		return;
+
 	UJwRpcConnection* pConn = Connection.Get();
 	if (pConn && pConn->IsConnected())
 	{
 		const FString finalData = FString::Printf(TEXT(R"({"id":"%s","result":%s})"), *Id, *result);
-		Connection->Send(finalData);
+		pConn->SendRespond(finalData, pConn->GetLane(EJwRpcLane::ByMethod, State ? State->Method : FString()), State ? State->Batch : nullptr);
 	}
+
+	if (pConn && State)
+		pConn->ReleaseBatchItem(State->Batch);
 }
 
 //#TODO needs valid code
 FJwRPCError FJwRPCError::Timeout{ -1, FString("timeout") };
 FJwRPCError FJwRPCError::NoConnection{-2, FString("no connection") };
+FJwRPCError FJwRPCError::RequestCancelled{ -32800, FString("request cancelled") };
+FJwRPCError FJwRPCError::Overloaded{ -32001, FString("overloaded") };
 
 FJwRPCError FJwRPCError::NoError{0, FString() };
+
+FJwRPCError FJwRPCError::ParseError{ -32700, FString("parse error") };
+FJwRPCError FJwRPCError::InvalidRequest{ -32600, FString("invalid request") };
+FJwRPCError FJwRPCError::MethodNotFound{ -32601, FString("method not found") };
+FJwRPCError FJwRPCError::InvalidParams{ -32602, FString("invalid params") };
+FJwRPCError FJwRPCError::InternalError{ -32603, FString("internal error") };
+FJwRPCError FJwRPCError::ServerError{ -32000, FString("server error") };
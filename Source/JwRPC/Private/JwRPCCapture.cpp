@@ -0,0 +1,403 @@
+// Copyright 1998-2018 Epic Games, Inc. All Rights Reserved.
+
+#include "JwRPCCapture.h"
+#include "HAL/FileManager.h"
+#include "HAL/PlatformFilemanager.h"
+#include "Async/MappedFileHandle.h"
+#include "Misc/FileHelper.h"
+
+static const ANSICHAR CaptureMagic[4] = { 'J', 'W', 'R', 'C' };
+//uint64 time + uint8 direction + uint32 size
+static const int64 FrameHeaderSize = 13;
+
+TSharedPtr<FJwRpcTrafficRecorder> FJwRpcTrafficRecorder::Create(const FString& filePath)
+{
+	FArchive* writer = IFileManager::Get().CreateFileWriter(*filePath);
+	if (!writer)
+	{
+		UE_LOG(LogJwRPC, Error, TEXT("failed to create capture file %s"), *filePath);
+		return nullptr;
+	}
+
+	uint32 version = Version;
+	writer->Serialize((void*)CaptureMagic, sizeof(CaptureMagic));
+	writer->Serialize(&version, sizeof(version));
+
+	TSharedPtr<FJwRpcTrafficRecorder> recorder = MakeShareable(new FJwRpcTrafficRecorder());
+	recorder->Writer = writer;
+	recorder->StartTime = FPlatformTime::Seconds();
+	recorder->LastFlushTime = recorder->StartTime;
+
+	UE_LOG(LogJwRPC, Log, TEXT("capturing traffic to %s"), *filePath);
+	return recorder;
+}
+
+FJwRpcTrafficRecorder::~FJwRpcTrafficRecorder()
+{
+	if (Writer)
+	{
+		Writer->Close();
+		delete Writer;
+	}
+}
+
+void FJwRpcTrafficRecorder::Record(EJwRpcFrameDirection direction, const FString& data)
+{
+	const double now = FPlatformTime::Seconds();
+	FTCHARToUTF8 converted(*data);
+
+	uint64 micros = (uint64)((now - StartTime) * 1000000.0);
+	uint8 dir = (uint8)direction;
+	uint32 size = (uint32)converted.Length();
+
+	Writer->Serialize(&micros, sizeof(micros));
+	Writer->Serialize(&dir, sizeof(dir));
+	Writer->Serialize(&size, sizeof(size));
+	Writer->Serialize((void*)converted.Get(), size);
+
+	//the writer is buffered, we flush once in a while so a crash doesn't lose much
+	if (now - LastFlushTime > 1)
+		Flush();
+}
+
+void FJwRpcTrafficRecorder::Flush()
+{
+	Writer->Flush();
+	LastFlushTime = FPlatformTime::Seconds();
+}
+
+FString FJwRpcCapturedFrame::ToString() const
+{
+	FUTF8ToTCHAR converted(Data, Size);
+	return FString(converted.Length(), converted.Get());
+}
+
+TUniquePtr<FJwRpcCaptureReader> FJwRpcCaptureReader::Open(const FString& filePath)
+{
+	TUniquePtr<FJwRpcCaptureReader> reader(new FJwRpcCaptureReader());
+
+	reader->MappedHandle = FPlatformFileManager::Get().GetPlatformFile().OpenMapped(*filePath);
+	if (reader->MappedHandle)
+		reader->MappedRegion = reader->MappedHandle->MapRegion();
+
+	if (reader->MappedRegion)
+	{
+		reader->Data = reader->MappedRegion->GetMappedPtr();
+		reader->Size = reader->MappedRegion->GetMappedSize();
+	}
+	else
+	{
+		if (!FFileHelper::LoadFileToArray(reader->Loaded, *filePath))
+		{
+			UE_LOG(LogJwRPC, Error, TEXT("failed to open capture file %s"), *filePath);
+			return nullptr;
+		}
+
+		reader->Data = reader->Loaded.GetData();
+		reader->Size = reader->Loaded.Num();
+	}
+
+	uint32 version = 0;
+	if (reader->Size < 8 || FMemory::Memcmp(reader->Data, CaptureMagic, sizeof(CaptureMagic)) != 0)
+	{
+		UE_LOG(LogJwRPC, Error, TEXT("%s is not a capture file"), *filePath);
+		return nullptr;
+	}
+
+	FMemory::Memcpy(&version, reader->Data + 4, sizeof(version));
+	if (version != FJwRpcTrafficRecorder::Version)
+	{
+		UE_LOG(LogJwRPC, Error, TEXT("capture file %s has unsupported version %u"), *filePath, version);
+		return nullptr;
+	}
+
+	reader->Offset = 8;
+	return reader;
+}
+
+FJwRpcCaptureReader::~FJwRpcCaptureReader()
+{
+	delete MappedRegion;
+	delete MappedHandle;
+}
+
+bool FJwRpcCaptureReader::Read(FJwRpcCapturedFrame& outFrame)
+{
+	if (Offset + FrameHeaderSize > Size)
+		return false;
+
+	uint64 micros;
+	uint8 dir;
+	uint32 size;
+	FMemory::Memcpy(&micros, Data + Offset, sizeof(micros));
+	FMemory::Memcpy(&dir, Data + Offset + 8, sizeof(dir));
+	FMemory::Memcpy(&size, Data + Offset + 9, sizeof(size));
+
+	//the last frame may be incomplete if the process died while writing
+	if (Offset + FrameHeaderSize + size > Size)
+		return false;
+
+	outFrame.Time = micros / 1000000.0;
+	outFrame.Direction = (EJwRpcFrameDirection)dir;
+	outFrame.Data = (const ANSICHAR*)(Data + Offset + FrameHeaderSize);
+	outFrame.Size = (int32)size;
+
+	Offset += FrameHeaderSize + size;
+	return true;
+}
+
+void FJwRpcReplaySocket::Connect()
+{
+	bConnected = true;
+	ConnectedEvent.Broadcast();
+}
+
+void FJwRpcReplaySocket::Close(int32 Code, const FString& Reason)
+{
+	if (!bConnected)
+		return;
+
+	bConnected = false;
+	ClosedEvent.Broadcast(Code, Reason, true);
+}
+
+void FJwRpcReplaySocket::Send(const FString& Data)
+{
+	NumSent++;
+	//bytes as they would be written to a real socket
+	BytesSent += FTCHARToUTF8(*Data).Length();
+	Sent.Add(Data);
+}
+
+void FJwRpcReplaySocket::Receive(const FString& data)
+{
+	MessageEvent.Broadcast(data);
+}
+
+UJwRpcReplayer* UJwRpcReplayer::StartReplay(const FString& filePath, TSubclassOf<UJwRpcConnection> connectionClass, float speed)
+{
+	TUniquePtr<FJwRpcCaptureReader> reader = FJwRpcCaptureReader::Open(filePath);
+	if (!reader)
+		return nullptr;
+
+	UJwRpcReplayer* pReplayer = NewObject<UJwRpcReplayer>((UObject*)GetTransientPackage(), NAME_None, RF_Transient);
+	pReplayer->Reader = MoveTemp(reader);
+	pReplayer->Speed = speed;
+	pReplayer->Socket = MakeShared<FJwRpcReplaySocket>();
+	pReplayer->Connection = UJwRpcConnection::CreateWithSocket(pReplayer->Socket.ToSharedRef(), connectionClass);
+
+	UE_LOG(LogJwRPC, Log, TEXT("replaying %s speed:%f"), *filePath, speed);
+	return pReplayer;
+}
+
+void UJwRpcReplayer::Stop()
+{
+	if (Reader)
+		Finish();
+}
+
+FJwRpcReplayStats UJwRpcReplayer::GetStats() const
+{
+	FJwRpcReplayStats stats = Stats;
+	stats.ReplayedOutgoing = Socket ? Socket->NumSent : 0;
+	return stats;
+}
+
+void UJwRpcReplayer::Tick(float DeltaTime)
+{
+	if (!Reader)
+		return;
+
+	const bool bMaxSpeed = Speed <= 0;
+	ReplayTime += DeltaTime * Speed;
+
+	//only the time the connection spends on the frames, reading and remapping them is the replayer's own work
+	float tickTime = 0;
+	int dispatched = 0;
+
+	while (!bMaxSpeed || dispatched < MaxFramesPerTick)
+	{
+		if (!bHasPendingFrame)
+		{
+			bHasPendingFrame = Reader->Read(PendingFrame);
+			if (!bHasPendingFrame)
+			{
+				Finish();
+				break;
+			}
+		}
+
+		if (!bMaxSpeed && PendingFrame.Time > ReplayTime)
+			break;
+
+		bHasPendingFrame = false;
+
+		if (PendingFrame.Direction == EJwRpcFrameDirection::Outgoing)
+		{
+			Stats.CapturedOutgoing++;
+			CollectRequestIds(PendingFrame.ToString(), CapturedRequestIds);
+			PairRequestIds();
+			continue;
+		}
+
+		CollectReplayedRequests();
+		FString message;
+		if (!RemapResponds(PendingFrame.ToString(), message))
+			continue;
+
+		const double dispatchStart = FPlatformTime::Seconds();
+		Socket->Receive(message);
+		const float dispatchTime = (float)(FPlatformTime::Seconds() - dispatchStart);
+
+		tickTime += dispatchTime;
+		Stats.FramesDispatched++;
+		Stats.TotalDispatchTime += dispatchTime;
+		Stats.MaxDispatchTime = FMath::Max(Stats.MaxDispatchTime, dispatchTime);
+		dispatched++;
+	}
+
+	CollectReplayedRequests();
+
+	Stats.Ticks++;
+	Stats.MaxTickTime = FMath::Max(Stats.MaxTickTime, tickTime);
+}
+
+void UJwRpcReplayer::Finish()
+{
+	Reader = nullptr;
+	bHasPendingFrame = false;
+	Stats.bFinished = true;
+	CapturedRequestIds.Reset();
+	ReplayedRequestIds.Reset();
+	RequestIdMap.Reset();
+
+	const FJwRpcReplayStats stats = GetStats();
+	UE_LOG(LogJwRPC, Log, TEXT("replay finished. frames:%d avg dispatch:%fms max dispatch:%fms max tick:%fms outgoing captured:%d replayed:%d skipped responds:%d"),
+		stats.FramesDispatched, stats.FramesDispatched ? stats.TotalDispatchTime * 1000 / stats.FramesDispatched : 0.0f,
+		stats.MaxDispatchTime * 1000, stats.MaxTickTime * 1000, stats.CapturedOutgoing, stats.ReplayedOutgoing, stats.SkippedResponds);
+}
+
+void UJwRpcReplayer::CollectRequestIds(const FString& data, TMap<FString, TArray<FString>>& into)
+{
+	static FString STR_method("method");
+	static FString STR_id("id");
+
+	//cheap check first, most captured messages are not requests of ours
+	if (!data.Contains(STR_method, ESearchCase::CaseSensitive) || !data.Contains(STR_id, ESearchCase::CaseSensitive))
+		return;
+
+	const FJwRpcJson json = UJwRpcJsonLibrary::Parse(data);
+	if (!json.Value)
+		return;
+
+	//a batch or a single message
+	TArray<TSharedPtr<FJsonValue>> items;
+	const TArray<TSharedPtr<FJsonValue>>* pArray = nullptr;
+	if (json.Value->TryGetArray(pArray))
+		items = *pArray;
+	else
+		items.Add(json.Value);
+
+	for (const TSharedPtr<FJsonValue>& item : items)
+	{
+		const TSharedPtr<FJsonObject>* pObject = nullptr;
+		FString method, id;
+		if (item && item->TryGetObject(pObject) && (*pObject)->TryGetStringField(STR_method, method) && (*pObject)->TryGetStringField(STR_id, id))
+			into.FindOrAdd(method).Add(id);
+	}
+}
+
+void UJwRpcReplayer::CollectReplayedRequests()
+{
+	if (!Socket || Socket->Sent.Num() == 0)
+		return;
+
+	TArray<FString> sent = MoveTemp(Socket->Sent);
+	Socket->Sent.Reset();
+
+	for (const FString& message : sent)
+		CollectRequestIds(message, ReplayedRequestIds);
+
+	PairRequestIds();
+}
+
+void UJwRpcReplayer::PairRequestIds()
+{
+	for (auto& pair : CapturedRequestIds)
+	{
+		TArray<FString>* pReplayed = ReplayedRequestIds.Find(pair.Key);
+		if (!pReplayed)
+			continue;
+
+		const int num = FMath::Min(pair.Value.Num(), pReplayed->Num());
+		for (int i = 0; i < num; i++)
+			RequestIdMap.Add(pair.Value[i], (*pReplayed)[i]);
+
+		pair.Value.RemoveAt(0, num, false);
+		pReplayed->RemoveAt(0, num, false);
+	}
+}
+
+bool UJwRpcReplayer::RemapResponds(const FString& message, FString& outMessage)
+{
+	static FString STR_method("method");
+	static FString STR_id("id");
+
+	//notifications and requests of the peer are delivered as they are
+	const FJwRpcJson json = UJwRpcJsonLibrary::Parse(message);
+	if (!json.Value)
+	{
+		outMessage = message;
+		return true;
+	}
+
+	const bool bBatch = json.Value->Type == EJson::Array;
+	TArray<TSharedPtr<FJsonValue>> items;
+	if (bBatch)
+		items = json.Value->AsArray();
+	else
+		items.Add(json.Value);
+
+	bool bChanged = false;
+	for (int i = items.Num() - 1; i >= 0; i--)
+	{
+		const TSharedPtr<FJsonObject>* pObject = nullptr;
+		FString id;
+		if (!items[i] || !items[i]->TryGetObject(pObject) || (*pObject)->HasField(STR_method) || !(*pObject)->TryGetStringField(STR_id, id))
+			continue;
+
+		FString replayedId;
+		if (RequestIdMap.RemoveAndCopyValue(id, replayedId))
+		{
+			(*pObject)->SetStringField(STR_id, replayedId);
+		}
+		else
+		{
+			Stats.SkippedResponds++;
+			items.RemoveAt(i);
+		}
+		bChanged = true;
+	}
+
+	if (items.Num() == 0)
+		return false;
+
+	if (!bChanged)
+		outMessage = message;
+	else if (bBatch)
+		outMessage = UJwRpcJsonLibrary::ToString(FJwRpcJson(MakeShared<FJsonValueArray>(items)));
+	else
+		outMessage = UJwRpcJsonLibrary::ToString(FJwRpcJson(items[0]));
+
+	return true;
+}
+
+bool UJwRpcReplayer::IsTickable() const
+{
+	return !IsTemplate() && Reader.IsValid();
+}
+
+TStatId UJwRpcReplayer::GetStatId() const
+{
+	return TStatId();
+}
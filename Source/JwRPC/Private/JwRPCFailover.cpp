@@ -0,0 +1,421 @@
+// Copyright 1998-2018 Epic Games, Inc. All Rights Reserved.
+
+#include "JwRPCFailover.h"
+#include "JsonBP.h"
+
+UJwRpcFailoverConnection* UJwRpcFailoverConnection::CreateAndConnect(const TArray<FString>& urls, TSubclassOf<UJwRpcConnection> connectionClass)
+{
+	UJwRpcFailoverConnection* pFailover = NewObject<UJwRpcFailoverConnection>((UObject*)GetTransientPackage(), NAME_None, RF_Transient);
+	const TSubclassOf<UJwRpcConnection> cls = connectionClass ? connectionClass : TSubclassOf<UJwRpcConnection>(UJwRpcConnection::StaticClass());
+
+	for (const FString& url : urls)
+	{
+		pFailover->URLs.Add(url);
+		pFailover->Endpoints.AddDefaulted();
+		pFailover->Connections.Add(UJwRpcConnection::CreateAndConnect(url, cls));
+	}
+
+	return pFailover;
+}
+
+FString UJwRpcFailoverConnection::Request(const FString& method, const FString& params, UJwRpcConnection::FSuccessCB onSuccess, UJwRpcConnection::FErrorCB onError)
+{
+	const FString id = FString::FromInt(++IdCounter);
+
+	FFailoverRequest& request = Requests.Add(id);
+	request.Method = method;
+	request.Params = params;
+	request.OnResult = onSuccess;
+	request.OnError = onError;
+	request.bIdempotent = IdempotentMethods.Contains(method);
+
+	const int endpoint = SelectEndpoint(request.Tried);
+	if (endpoint == INDEX_NONE)
+	{
+		FFailoverRequest failed;
+		Requests.RemoveAndCopyValue(id, failed);
+		failed.OnError.ExecuteIfBound(FJwRPCError::NoConnection);
+		return id;
+	}
+
+	SendAttempt(id, request, endpoint, false);
+
+	if (bHedging && request.bIdempotent && Endpoints.Num() > 1)
+	{
+		const float delay = GetHedgeDelay(method);
+		if (delay > 0)
+		{
+			request.HedgeTime = FPlatformTime::Seconds() + delay;
+			HedgeQueue.Add(id);
+		}
+	}
+
+	return id;
+}
+
+FString UJwRpcFailoverConnection::Request(const FString& method, TSharedPtr<FJsonValue> params, UJwRpcConnection::FSuccessCB onSuccess, UJwRpcConnection::FErrorCB onError)
+{
+	return Request(method, params ? HelperStringifyJSON(params) : FString(), onSuccess, onError);
+}
+
+void UJwRpcFailoverConnection::Notify(const FString& method, const FString& params)
+{
+	const int endpoint = SelectEndpoint(TArray<int, TInlineAllocator<4>>());
+	if (endpoint != INDEX_NONE)
+		Connections[endpoint]->Notify(method, params);
+}
+
+void UJwRpcFailoverConnection::Notify(const FString& method, TSharedPtr<FJsonValue> params)
+{
+	Notify(method, params ? HelperStringifyJSON(params) : FString());
+}
+
+FString UJwRpcFailoverConnection::K2_Request(const FString& method, const FString& params, FOnRPCResult onSuccess, FOnRPCError onError)
+{
+	return Request(method, params, UJwRpcConnection::FSuccessCB::CreateLambda([onSuccess](TSharedPtr<FJsonValue> result) {
+		onSuccess.ExecuteIfBound(HelperStringifyJSON(result));
+	}), UJwRpcConnection::FErrorCB::CreateLambda([onError](const FJwRPCError& err) {
+		onError.ExecuteIfBound(err);
+	}));
+}
+
+void UJwRpcFailoverConnection::K2_Notify(const FString& method, const FString& params)
+{
+	Notify(method, params);
+}
+
+bool UJwRpcFailoverConnection::CancelRequest(const FString& id)
+{
+	FFailoverRequest removed;
+	if (!Requests.RemoveAndCopyValue(id, removed))
+		return false;
+
+	HedgeQueue.Remove(id);
+
+	for (const FAttempt& attempt : removed.Attempts)
+	{
+		if (UJwRpcConnection* pConn = Connections[attempt.Endpoint])
+			pConn->CancelRequest(attempt.Id, true);
+	}
+
+	return true;
+}
+
+void UJwRpcFailoverConnection::RegisterNotificationCallback(const FString& method, UJwRpcConnection::FNotifyCB callback)
+{
+	for (UJwRpcConnection* pConn : Connections)
+	{
+		if (pConn)
+			pConn->RegisterNotificationCallback(method, callback);
+	}
+}
+
+void UJwRpcFailoverConnection::RegisterRequestCallback(const FString& method, UJwRpcConnection::FRequestCB callback)
+{
+	for (UJwRpcConnection* pConn : Connections)
+	{
+		if (pConn)
+			pConn->RegisterRequestCallback(method, callback);
+	}
+}
+
+void UJwRpcFailoverConnection::SetIdempotent(const FString& method, bool bIdempotent)
+{
+	if (bIdempotent)
+		IdempotentMethods.Add(method);
+	else
+		IdempotentMethods.Remove(method);
+}
+
+void UJwRpcFailoverConnection::SetHedging(bool bEnable, float percentile, float minDelay)
+{
+	bHedging = bEnable;
+	HedgePercentile = FMath::Clamp(percentile, 0.0f, 1.0f);
+	MinHedgeDelay = FMath::Max(0.001f, minDelay);
+}
+
+void UJwRpcFailoverConnection::SetFailureThreshold(int maxConsecutiveErrors, float cooldown)
+{
+	MaxConsecutiveErrors = FMath::Max(1, maxConsecutiveErrors);
+	ErrorCooldown = FMath::Max(0.0f, cooldown);
+}
+
+TArray<FJwRpcEndpointStats> UJwRpcFailoverConnection::GetEndpointStats() const
+{
+	const double now = FPlatformTime::Seconds();
+
+	TArray<FJwRpcEndpointStats> stats;
+	for (int i = 0; i < Endpoints.Num(); i++)
+	{
+		const FEndpoint& ep = Endpoints[i];
+
+		FJwRpcEndpointStats& item = stats.AddDefaulted_GetRef();
+		item.URL = URLs[i];
+		item.bConnected = Connections[i] && Connections[i]->IsConnected();
+		item.bHealthy = IsHealthy(i, now);
+		item.SmoothedRTT = ep.SmoothedRTT;
+		item.Requests = ep.Requests;
+		item.Errors = ep.Errors;
+		item.ConsecutiveErrors = ep.ConsecutiveErrors;
+		item.HedgesSent = ep.HedgesSent;
+		item.HedgesWon = ep.HedgesWon;
+	}
+
+	return stats;
+}
+
+UJwRpcConnection* UJwRpcFailoverConnection::GetBestConnection() const
+{
+	const int endpoint = SelectEndpoint(TArray<int, TInlineAllocator<4>>());
+	return endpoint != INDEX_NONE ? Connections[endpoint] : nullptr;
+}
+
+void UJwRpcFailoverConnection::Close()
+{
+	//the requests must not be sent to the other endpoints while they are closing
+	TMap<FString, FFailoverRequest> killed = MoveTemp(Requests);
+	Requests.Reset();
+	HedgeQueue.Reset();
+
+	for (auto& pair : killed)
+	{
+		for (const FAttempt& attempt : pair.Value.Attempts)
+		{
+			if (UJwRpcConnection* pConn = Connections[attempt.Endpoint])
+				pConn->CancelRequest(attempt.Id, false);
+		}
+	}
+
+	for (UJwRpcConnection* pConn : Connections)
+	{
+		if (pConn)
+			pConn->Close();
+	}
+
+	for (auto& pair : killed)
+		pair.Value.OnError.ExecuteIfBound(FJwRPCError::NoConnection);
+}
+
+void UJwRpcFailoverConnection::BeginDestroy()
+{
+	Requests.Reset();
+	HedgeQueue.Reset();
+
+	Super::BeginDestroy();
+}
+
+bool UJwRpcFailoverConnection::IsHealthy(int endpoint, double now) const
+{
+	const FEndpoint& ep = Endpoints[endpoint];
+	return ep.ConsecutiveErrors < MaxConsecutiveErrors || now - ep.LastErrorTime > ErrorCooldown;
+}
+
+float UJwRpcFailoverConnection::GetScore(int endpoint, double now) const
+{
+	const FEndpoint& ep = Endpoints[endpoint];
+	if (ep.SmoothedRTT >= 0 && now - ep.LastSampleTime < SampleLifetime)
+		return ep.SmoothedRTT;
+
+	//idle endpoints are judged by their heartbeats, or tried if there is none
+	const float heartbeatRTT = Connections[endpoint]->GetSmoothedRTT();
+	return heartbeatRTT >= 0 ? heartbeatRTT : 0;
+}
+
+int UJwRpcFailoverConnection::SelectEndpoint(const TArray<int, TInlineAllocator<4>>& exclude) const
+{
+	const double now = FPlatformTime::Seconds();
+
+	//connected and healthy ones first, then connected ones, then the ones that may connect
+	int best = INDEX_NONE;
+	int bestTier = 3;
+	float bestScore = 0;
+
+	for (int i = 0; i < Connections.Num(); i++)
+	{
+		if (!Connections[i] || exclude.Contains(i))
+			continue;
+
+		const int tier = Connections[i]->IsConnected() ? (IsHealthy(i, now) ? 0 : 1) : 2;
+		const float score = GetScore(i, now);
+		if (tier < bestTier || (tier == bestTier && score < bestScore))
+		{
+			best = i;
+			bestTier = tier;
+			bestScore = score;
+		}
+	}
+
+	return best;
+}
+
+void UJwRpcFailoverConnection::SendAttempt(const FString& id, FFailoverRequest& request, int endpoint, bool bHedge)
+{
+	FEndpoint& ep = Endpoints[endpoint];
+	ep.Requests++;
+	if (bHedge)
+		ep.HedgesSent++;
+
+	request.Tried.AddUnique(endpoint);
+
+	FAttempt& attempt = request.Attempts.AddDefaulted_GetRef();
+	attempt.Endpoint = endpoint;
+	attempt.SendTime = FPlatformTime::Seconds();
+	attempt.bHedge = bHedge;
+	attempt.Id = Connections[endpoint]->Request(request.Method, request.Params,
+		UJwRpcConnection::FSuccessCB::CreateUObject(this, &UJwRpcFailoverConnection::OnAttemptResult, id, endpoint),
+		UJwRpcConnection::FErrorCB::CreateUObject(this, &UJwRpcFailoverConnection::OnAttemptError, id, endpoint)).Id;
+}
+
+void UJwRpcFailoverConnection::OnAttemptResult(TSharedPtr<FJsonValue> result, FString id, int endpoint)
+{
+	FFailoverRequest* pRequest = Requests.Find(id);
+	if (!pRequest)
+		return;
+
+	const int index = pRequest->Attempts.IndexOfByPredicate([endpoint](const FAttempt& attempt) { return attempt.Endpoint == endpoint; });
+	if (index == INDEX_NONE)
+		return;
+
+	const double now = FPlatformTime::Seconds();
+	const FAttempt& winner = pRequest->Attempts[index];
+	AddSample(endpoint, now - winner.SendTime);
+	if (winner.bHedge)
+		Endpoints[endpoint].HedgesWon++;
+
+	//respond time of the method is measured from the first copy, as if it was not hedged
+	double firstSendTime = winner.SendTime;
+	for (const FAttempt& attempt : pRequest->Attempts)
+		firstSendTime = FMath::Min(firstSendTime, attempt.SendTime);
+	Latencies.FindOrAdd(pRequest->Method).Add((float)(now - firstSendTime));
+
+	FFailoverRequest finished;
+	Requests.RemoveAndCopyValue(id, finished);
+	HedgeQueue.Remove(id);
+
+	//the slower copies are not needed anymore
+	for (const FAttempt& attempt : finished.Attempts)
+	{
+		if (attempt.Endpoint != endpoint && Connections[attempt.Endpoint])
+			Connections[attempt.Endpoint]->CancelRequest(attempt.Id, true);
+	}
+
+	finished.OnResult.ExecuteIfBound(result);
+}
+
+void UJwRpcFailoverConnection::OnAttemptError(const FJwRPCError& error, FString id, int endpoint)
+{
+	FFailoverRequest* pRequest = Requests.Find(id);
+	if (!pRequest)
+		return;
+
+	const int index = pRequest->Attempts.IndexOfByPredicate([endpoint](const FAttempt& attempt) { return attempt.Endpoint == endpoint; });
+	if (index == INDEX_NONE)
+		return;
+
+	pRequest->Attempts.RemoveAt(index);
+
+	if (IsTransportError(error))
+		AddError(endpoint);
+
+	//another copy may still answer
+	if (pRequest->Attempts.Num())
+		return;
+
+	//overloaded requests are rejected before running, so any of them can be sent again
+	const bool bRetry = (pRequest->bIdempotent && IsTransportError(error)) || error.Code == FJwRPCError::Overloaded.Code;
+	if (bRetry)
+	{
+		const int next = SelectEndpoint(pRequest->Tried);
+		if (next != INDEX_NONE)
+		{
+			UE_LOG(LogJwRPC, Log, TEXT("failing over %s from %s to %s. error:%s"), *pRequest->Method, *URLs[endpoint], *URLs[next], *error.Message);
+			SendAttempt(id, *pRequest, next, false);
+			return;
+		}
+	}
+
+	FFailoverRequest failed;
+	Requests.RemoveAndCopyValue(id, failed);
+	HedgeQueue.Remove(id);
+
+	failed.OnError.ExecuteIfBound(error);
+}
+
+float UJwRpcFailoverConnection::GetHedgeDelay(const FString& method) const
+{
+	const UJwRpcConnection::FLatencyHistory* pHistory = Latencies.Find(method);
+	if (!pHistory || pHistory->Samples.Num() < MinHedgeSamples)
+		return 0;
+
+	return FMath::Max(pHistory->Percentile(HedgePercentile), MinHedgeDelay);
+}
+
+void UJwRpcFailoverConnection::AddSample(int endpoint, double seconds)
+{
+	const double now = FPlatformTime::Seconds();
+	const float sample = (float)seconds;
+
+	FEndpoint& ep = Endpoints[endpoint];
+	//an old average says nothing about the endpoint now
+	if (ep.SmoothedRTT < 0 || now - ep.LastSampleTime > SampleLifetime)
+		ep.SmoothedRTT = sample;
+	else
+		ep.SmoothedRTT = 0.875f * ep.SmoothedRTT + 0.125f * sample;
+
+	ep.LastSampleTime = now;
+	ep.ConsecutiveErrors = 0;
+}
+
+void UJwRpcFailoverConnection::AddError(int endpoint)
+{
+	FEndpoint& ep = Endpoints[endpoint];
+	ep.Errors++;
+	ep.ConsecutiveErrors++;
+	ep.LastErrorTime = FPlatformTime::Seconds();
+}
+
+bool UJwRpcFailoverConnection::IsTransportError(const FJwRPCError& error)
+{
+	return error.Code == FJwRPCError::Timeout.Code || error.Code == FJwRPCError::NoConnection.Code || error.Code == FJwRPCError::Overloaded.Code;
+}
+
+void UJwRpcFailoverConnection::Tick(float DeltaTime)
+{
+	const double now = FPlatformTime::Seconds();
+
+	TArray<FString> due;
+	for (const FString& id : HedgeQueue)
+	{
+		const FFailoverRequest* pRequest = Requests.Find(id);
+		if (!pRequest || pRequest->HedgeTime <= now)
+			due.Add(id);
+	}
+
+	for (const FString& id : due)
+	{
+		HedgeQueue.Remove(id);
+
+		FFailoverRequest* pRequest = Requests.Find(id);
+		if (!pRequest || pRequest->HedgeTime == 0 || pRequest->Attempts.Num() != 1)
+			continue;
+
+		pRequest->HedgeTime = 0;
+
+		//a duplicate is only worth it on a healthy live endpoint
+		const int endpoint = SelectEndpoint(pRequest->Tried);
+		if (endpoint == INDEX_NONE || !Connections[endpoint]->IsConnected() || !IsHealthy(endpoint, now))
+			continue;
+
+		SendAttempt(id, *pRequest, endpoint, true);
+	}
+}
+
+bool UJwRpcFailoverConnection::IsTickable() const
+{
+	return !IsTemplate() && HedgeQueue.Num() > 0;
+}
+
+TStatId UJwRpcFailoverConnection::GetStatId() const
+{
+	return TStatId();
+}
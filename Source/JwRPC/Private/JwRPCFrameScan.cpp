@@ -0,0 +1,127 @@
+// Copyright 1998-2018 Epic Games, Inc. All Rights Reserved.
+
+#include "JwRPCFrameScan.h"
+
+static void SkipWhitespace(const TCHAR* p, int32 len, int32& i)
+{
+	while (i < len && FChar::IsWhitespace(p[i]))
+		i++;
+}
+
+//i is at the opening quote. returns false if the string is not terminated
+static bool SkipString(const TCHAR* p, int32 len, int32& i)
+{
+	for (i++; i < len; i++)
+	{
+		if (p[i] == TCHAR('\\'))
+			i++;
+		else if (p[i] == TCHAR('"'))
+		{
+			i++;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool SkipValue(const TCHAR* p, int32 len, int32& i)
+{
+	if (i >= len)
+		return false;
+
+	if (p[i] == TCHAR('"'))
+		return SkipString(p, len, i);
+
+	if (p[i] == TCHAR('{') || p[i] == TCHAR('['))
+	{
+		int depth = 0;
+		while (i < len)
+		{
+			const TCHAR c = p[i];
+			if (c == TCHAR('"'))
+			{
+				if (!SkipString(p, len, i))
+					return false;
+				continue;
+			}
+
+			if (c == TCHAR('{') || c == TCHAR('['))
+				depth++;
+			else if ((c == TCHAR('}') || c == TCHAR(']')) && --depth == 0)
+			{
+				i++;
+				return true;
+			}
+			i++;
+		}
+		return false;
+	}
+
+	//number, true, false, null
+	const int32 start = i;
+	while (i < len && p[i] != TCHAR(',') && p[i] != TCHAR('}') && p[i] != TCHAR(']') && !FChar::IsWhitespace(p[i]))
+		i++;
+	return i > start;
+}
+
+bool JwRpcScanFrame(const FString& data, FJwRpcFrameScan& out)
+{
+	const TCHAR* p = *data;
+	const int32 len = data.Len();
+	int32 i = 0;
+
+	SkipWhitespace(p, len, i);
+	if (i >= len || p[i] != TCHAR('{'))
+		return false;
+	i++;
+
+	for (;;)
+	{
+		SkipWhitespace(p, len, i);
+		if (i < len && p[i] == TCHAR('}'))
+			return true;
+
+		if (i >= len || p[i] != TCHAR('"'))
+			return false;
+
+		const int32 keyStart = i + 1;
+		if (!SkipString(p, len, i))
+			return false;
+		const int32 keyLen = i - 1 - keyStart;
+
+		SkipWhitespace(p, len, i);
+		if (i >= len || p[i] != TCHAR(':'))
+			return false;
+		i++;
+		SkipWhitespace(p, len, i);
+
+		const int32 valueStart = i;
+		if (!SkipValue(p, len, i))
+			return false;
+
+		if (keyLen == 2 && FCString::Strncmp(p + keyStart, TEXT("id"), 2) == 0)
+		{
+			//a null id is the same as no id
+			if (FCString::Strncmp(p + valueStart, TEXT("null"), 4) != 0)
+			{
+				out.IdStart = valueStart;
+				out.IdEnd = i;
+			}
+		}
+		else if (keyLen == 6 && FCString::Strncmp(p + keyStart, TEXT("method"), 6) == 0)
+		{
+			out.bHasMethod = true;
+			if (p[valueStart] == TCHAR('"'))
+				out.Method = FString(i - valueStart - 2, p + valueStart + 1);
+		}
+
+		SkipWhitespace(p, len, i);
+		if (i < len && p[i] == TCHAR(','))
+		{
+			i++;
+			continue;
+		}
+
+		return i < len && p[i] == TCHAR('}');
+	}
+}
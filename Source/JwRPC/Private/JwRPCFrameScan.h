@@ -0,0 +1,18 @@
+// Copyright 1998-2018 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+//positions of the top level fields of a message, found without building a DOM
+struct FJwRpcFrameScan
+{
+	bool bHasMethod = false;
+	FString Method;
+	//range of the id value in the message, quotes included. IdStart is INDEX_NONE if there is no id
+	int32 IdStart = INDEX_NONE;
+	int32 IdEnd = INDEX_NONE;
+};
+
+//finds the top level fields of a json object message. returns false if it is not a well formed object
+bool JwRpcScanFrame(const FString& data, FJwRpcFrameScan& out);
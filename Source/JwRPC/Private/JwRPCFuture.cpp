@@ -0,0 +1,447 @@
+// Copyright 1998-2018 Epic Games, Inc. All Rights Reserved.
+
+#include "JwRPCFuture.h"
+#include "Async/Async.h"
+#include "Misc/ScopeLock.h"
+
+//a result without json trees, used to hand a result to another thread.
+//FJsonValue uses not thread safe shared pointers, so a tree never crosses threads, each thread parses one of its own
+struct FJwRpcResultText
+{
+	FString Value;
+	bool bHasValue = false;
+	FJwRPCError Error;
+	int Index = INDEX_NONE;
+
+	void Set(const FJwRpcResult& result)
+	{
+		bHasValue = result.Value.IsValid();
+		Value = bHasValue ? UJwRpcJsonLibrary::ToString(FJwRpcJson(result.Value)) : FString();
+		Error = result.Error;
+		Index = result.Index;
+	}
+
+	FJwRpcResult ToResult() const
+	{
+		FJwRpcResult result;
+		if (bHasValue)
+			result.Value = UJwRpcJsonLibrary::Parse(Value).Value;
+		result.Error = Error;
+		result.Index = Index;
+		return result;
+	}
+};
+
+/*
+a result set on the game thread keeps its tree and is serialized only once another thread needs it,
+the serializing is done on the game thread too. results set on other threads are kept as text right away
+since there is no way back to the thread that owns the tree.
+*/
+struct FJwRpcFutureState : public TSharedFromThis<FJwRpcFutureState, ESPMode::ThreadSafe>
+{
+	struct FPending
+	{
+		FJwRpcFuture::FContinuation Function;
+		ENamedThreads::Type Thread;
+		//runs on whatever thread sets the result. used by the combinators
+		bool bInline;
+	};
+
+	FCriticalSection Lock;
+	bool bReady = false;
+	bool bSetOnGameThread = false;
+	//only touched on the game thread
+	FJwRpcResult Result;
+	//Text doesn't change once bHasText is set
+	bool bHasText = false;
+	bool bTextRequested = false;
+	FJwRpcResultText Text;
+	TArray<FPending, TInlineAllocator<1>> Pending;
+
+	static bool IsCurrentThread(ENamedThreads::Type thread)
+	{
+		const ENamedThreads::Type target = ENamedThreads::GetThreadIndex(thread);
+		if (target == ENamedThreads::GameThread)
+			return IsInGameThread();
+
+		//worker and unknown threads are reported as AnyThread
+		return target == ENamedThreads::AnyThread && ENamedThreads::GetThreadIndex(FTaskGraphInterface::Get().GetCurrentThreadIfKnown()) == ENamedThreads::AnyThread;
+	}
+
+	static bool NeedsDispatch(const FPending& pending)
+	{
+		return !pending.bInline && !IsCurrentThread(pending.Thread);
+	}
+
+	/*
+	@param local	- the result with a tree of the current thread, parsed from text if null
+	@param text		- only needed if the function runs on another thread
+	*/
+	static void Run(const FPending& pending, const FJwRpcResult* local, const FJwRpcResultText* text)
+	{
+		if (!NeedsDispatch(pending))
+		{
+			pending.Function(local ? *local : text->ToResult());
+			return;
+		}
+
+		FJwRpcFuture::FContinuation function = pending.Function;
+		FJwRpcResultText copy = *text;
+		AsyncTask(pending.Thread, [function, copy]() {
+			function(copy.ToResult());
+		});
+	}
+
+	//game thread only. serializes the tree on the first call
+	const FJwRpcResultText& GetText()
+	{
+		FScopeLock lock(&Lock);
+		if (!bHasText)
+		{
+			Text.Set(Result);
+			bHasText = true;
+		}
+		return Text;
+	}
+
+	//whether the result can be read on the current thread. if it waits for the text, asks the game thread to make it
+	bool IsReadyHere()
+	{
+		{
+			FScopeLock lock(&Lock);
+			if (!bReady)
+				return false;
+			if (!bSetOnGameThread || bHasText || IsInGameThread())
+				return true;
+			if (bTextRequested)
+				return false;
+			bTextRequested = true;
+		}
+
+		TSharedRef<FJwRpcFutureState, ESPMode::ThreadSafe> self = AsShared();
+		AsyncTask(ENamedThreads::GameThread, [self]() {
+			self->GetText();
+		});
+		return false;
+	}
+
+	void Add(FPending&& pending)
+	{
+		bool bHasTextNow;
+		{
+			FScopeLock lock(&Lock);
+			if (!bReady)
+			{
+				Pending.Add(MoveTemp(pending));
+				return;
+			}
+			bHasTextNow = bHasText;
+		}
+
+		if (bSetOnGameThread)
+		{
+			if (IsInGameThread())
+			{
+				Run(pending, &Result, NeedsDispatch(pending) ? &GetText() : nullptr);
+				return;
+			}
+
+			if (!bHasTextNow)
+			{
+				//the tree can't be read here, continue on the game thread
+				TSharedRef<FJwRpcFutureState, ESPMode::ThreadSafe> self = AsShared();
+				AsyncTask(ENamedThreads::GameThread, [self, pending]() {
+					self->Add(FPending(pending));
+				});
+				return;
+			}
+		}
+
+		Run(pending, nullptr, &Text);
+	}
+
+	void Set(const FJwRpcResult& result)
+	{
+		const bool bGameThread = IsInGameThread();
+		FJwRpcResultText text;
+		if (!bGameThread)
+			text.Set(result);
+
+		TArray<FPending, TInlineAllocator<1>> pending;
+		{
+			FScopeLock lock(&Lock);
+			if (bReady)
+				return;
+
+			bReady = true;
+			bSetOnGameThread = bGameThread;
+			if (bGameThread)
+			{
+				Result = result;
+			}
+			else
+			{
+				Text = MoveTemp(text);
+				bHasText = true;
+			}
+			pending = MoveTemp(Pending);
+		}
+
+		for (const FPending& item : pending)
+			Run(item, &result, NeedsDispatch(item) ? &GetText() : nullptr);
+	}
+
+	//for results that are assembled as text on a thread other than the game thread
+	void SetText(FJwRpcResultText&& text)
+	{
+		TArray<FPending, TInlineAllocator<1>> pending;
+		{
+			FScopeLock lock(&Lock);
+			if (bReady)
+				return;
+
+			bReady = true;
+			Text = MoveTemp(text);
+			bHasText = true;
+			pending = MoveTemp(Pending);
+		}
+
+		for (const FPending& item : pending)
+			Run(item, nullptr, &Text);
+	}
+};
+
+bool FJwRpcFuture::IsReady() const
+{
+	return State && State->IsReadyHere();
+}
+
+FJwRpcResult FJwRpcFuture::GetResult() const
+{
+	if (!State || !State->IsReadyHere())
+		return FJwRpcResult();
+
+	if (State->bSetOnGameThread && IsInGameThread())
+		return State->Result;
+
+	return State->Text.ToResult();
+}
+
+void FJwRpcFuture::OnReady(FContinuation continuation) const
+{
+	if (State)
+		State->Add(FJwRpcFutureState::FPending{ MoveTemp(continuation), ENamedThreads::AnyThread, true });
+}
+
+FJwRpcFuture FJwRpcFuture::Then(FContinuation continuation, ENamedThreads::Type thread) const
+{
+	FJwRpcPromise next;
+	if (State)
+	{
+		State->Add(FJwRpcFutureState::FPending{ [continuation, next](const FJwRpcResult& result) {
+			continuation(result);
+			next.SetResult(result);
+		}, thread, false });
+	}
+
+	return next.GetFuture();
+}
+
+FJwRpcFuture FJwRpcFuture::Chain(FChainedContinuation continuation, ENamedThreads::Type thread) const
+{
+	FJwRpcPromise next;
+	if (State)
+	{
+		State->Add(FJwRpcFutureState::FPending{ [continuation, next](const FJwRpcResult& result) {
+			FJwRpcFuture inner = continuation(result);
+			if (!inner.IsValid())
+			{
+				FJwRpcResult failed;
+				failed.Error = FJwRPCError::InternalError;
+				next.SetResult(failed);
+				return;
+			}
+
+			inner.OnReady([next](const FJwRpcResult& innerResult) {
+				next.SetResult(innerResult);
+			});
+		}, thread, false });
+	}
+
+	return next.GetFuture();
+}
+
+FJwRpcFuture FJwRpcFuture::WhenAll(const TArray<FJwRpcFuture>& futures)
+{
+	FJwRpcPromise promise;
+	if (futures.Num() == 0)
+	{
+		promise.SetValue(MakeShared<FJsonValueArray>(TArray<TSharedPtr<FJsonValue>>()));
+		return promise.GetFuture();
+	}
+
+	struct FGather
+	{
+		FCriticalSection Lock;
+		//values set on the game thread are kept as trees, the others as text since they may be set on different threads
+		TArray<TSharedPtr<FJsonValue>> Trees;
+		TArray<FString> Texts;
+		bool bHasTrees = false;
+		FJwRPCError Error;
+		int FirstErrorIndex = MAX_int32;
+		int Remaining = 0;
+
+		void Complete(const TSharedRef<FGather, ESPMode::ThreadSafe>& self, const FJwRpcPromise& promise)
+		{
+			if (IsInGameThread())
+			{
+				TArray<TSharedPtr<FJsonValue>> values;
+				values.Reserve(Trees.Num());
+				for (int i = 0; i < Trees.Num(); i++)
+				{
+					TSharedPtr<FJsonValue> value = Texts[i].IsEmpty() ? Trees[i] : UJwRpcJsonLibrary::Parse(Texts[i]).Value;
+					values.Add(value ? value : MakeShared<FJsonValueNull>());
+				}
+
+				FJwRpcResult all;
+				all.Value = MakeShared<FJsonValueArray>(values);
+				all.Error = Error;
+				promise.SetResult(all);
+				return;
+			}
+
+			if (bHasTrees)
+			{
+				AsyncTask(ENamedThreads::GameThread, [self, promise]() {
+					self->Complete(self, promise);
+				});
+				return;
+			}
+
+			for (FString& text : Texts)
+			{
+				if (text.IsEmpty())
+					text = TEXT("null");
+			}
+
+			FJwRpcResultText all;
+			all.bHasValue = true;
+			all.Value = TEXT("[") + FString::Join(Texts, TEXT(",")) + TEXT("]");
+			all.Error = Error;
+			promise.State->SetText(MoveTemp(all));
+		}
+	};
+
+	TSharedRef<FGather, ESPMode::ThreadSafe> gather = MakeShared<FGather, ESPMode::ThreadSafe>();
+	gather->Trees.SetNum(futures.Num());
+	gather->Texts.SetNum(futures.Num());
+	gather->Remaining = futures.Num();
+
+	for (int i = 0; i < futures.Num(); i++)
+	{
+		FJwRpcFuture future = futures[i];
+		if (!future.IsValid())
+		{
+			FJwRpcResult invalid;
+			invalid.Error = FJwRPCError::InternalError;
+			future = MakeReady(invalid);
+		}
+
+		future.OnReady([gather, promise, i](const FJwRpcResult& result) {
+			const bool bGameThread = IsInGameThread();
+			const TSharedPtr<FJsonValue> value = result.IsOk() ? result.Value : nullptr;
+			const FString text = !bGameThread && value ? UJwRpcJsonLibrary::ToString(FJwRpcJson(value)) : FString();
+
+			bool bDone;
+			{
+				FScopeLock lock(&gather->Lock);
+				if (bGameThread)
+				{
+					gather->Trees[i] = value;
+					gather->bHasTrees |= value.IsValid();
+				}
+				else
+				{
+					gather->Texts[i] = text;
+				}
+
+				if (!result.IsOk() && i < gather->FirstErrorIndex)
+				{
+					gather->FirstErrorIndex = i;
+					gather->Error = result.Error;
+				}
+				bDone = --gather->Remaining == 0;
+			}
+
+			if (bDone)
+				gather->Complete(gather, promise);
+		});
+	}
+
+	return promise.GetFuture();
+}
+
+FJwRpcFuture FJwRpcFuture::WhenAny(const TArray<FJwRpcFuture>& futures)
+{
+	FJwRpcPromise promise;
+	for (int i = 0; i < futures.Num(); i++)
+	{
+		//only the first result is taken by the promise
+		futures[i].OnReady([promise, i](const FJwRpcResult& result) {
+			FJwRpcResult first = result;
+			first.Index = i;
+			promise.SetResult(first);
+		});
+	}
+
+	return promise.GetFuture();
+}
+
+FJwRpcFuture FJwRpcFuture::MakeReady(const FJwRpcResult& result)
+{
+	FJwRpcPromise promise;
+	promise.SetResult(result);
+	return promise.GetFuture();
+}
+
+FJwRpcPromise::FJwRpcPromise() : State(MakeShared<FJwRpcFutureState, ESPMode::ThreadSafe>())
+{
+}
+
+FJwRpcFuture FJwRpcPromise::GetFuture() const
+{
+	FJwRpcFuture future;
+	future.State = State;
+	return future;
+}
+
+void FJwRpcPromise::SetResult(const FJwRpcResult& result) const
+{
+	State->Set(result);
+}
+
+void FJwRpcPromise::SetValue(TSharedPtr<FJsonValue> value) const
+{
+	FJwRpcResult result;
+	result.Value = value;
+	State->Set(result);
+}
+
+void FJwRpcPromise::SetError(const FJwRPCError& error) const
+{
+	FJwRpcResult result;
+	result.Error = error;
+	State->Set(result);
+}
+
+FJwRpcBatchScope::FJwRpcBatchScope(UJwRpcConnection* connection) : Connection(connection)
+{
+	if (connection)
+		connection->BeginBatch();
+}
+
+FJwRpcBatchScope::~FJwRpcBatchScope()
+{
+	if (UJwRpcConnection* pConn = Connection.Get())
+		pConn->EndBatch();
+}
@@ -0,0 +1,112 @@
+// Copyright 1998-2018 Epic Games, Inc. All Rights Reserved.
+
+#include "JwRPCJson.h"
+#include "JsonBP.h"
+#include "Serialization/JsonReader.h"
+#include "Serialization/JsonSerializer.h"
+
+bool UJwRpcJsonLibrary::IsValid(const FJwRpcJson& json)
+{
+	return json.Value.IsValid();
+}
+
+bool UJwRpcJsonLibrary::IsNull(const FJwRpcJson& json)
+{
+	return !json.Value || json.Value->IsNull();
+}
+
+FString UJwRpcJsonLibrary::AsString(const FJwRpcJson& json)
+{
+	FString ret;
+	if (json.Value)
+		json.Value->TryGetString(ret);
+	return ret;
+}
+
+float UJwRpcJsonLibrary::AsNumber(const FJwRpcJson& json)
+{
+	double ret = 0;
+	if (json.Value)
+		json.Value->TryGetNumber(ret);
+	return (float)ret;
+}
+
+int UJwRpcJsonLibrary::AsInt(const FJwRpcJson& json)
+{
+	int32 ret = 0;
+	if (json.Value)
+		json.Value->TryGetNumber(ret);
+	return ret;
+}
+
+bool UJwRpcJsonLibrary::AsBool(const FJwRpcJson& json)
+{
+	bool ret = false;
+	if (json.Value)
+		json.Value->TryGetBool(ret);
+	return ret;
+}
+
+FJwRpcJson UJwRpcJsonLibrary::GetField(const FJwRpcJson& json, const FString& name)
+{
+	const TSharedPtr<FJsonObject>* pObject = nullptr;
+	if (json.Value && json.Value->TryGetObject(pObject))
+		return FJwRpcJson((*pObject)->TryGetField(name));
+
+	return FJwRpcJson();
+}
+
+bool UJwRpcJsonLibrary::HasField(const FJwRpcJson& json, const FString& name)
+{
+	const TSharedPtr<FJsonObject>* pObject = nullptr;
+	return json.Value && json.Value->TryGetObject(pObject) && (*pObject)->HasField(name);
+}
+
+TArray<FString> UJwRpcJsonLibrary::GetFieldNames(const FJwRpcJson& json)
+{
+	TArray<FString> names;
+	const TSharedPtr<FJsonObject>* pObject = nullptr;
+	if (json.Value && json.Value->TryGetObject(pObject))
+		(*pObject)->Values.GetKeys(names);
+
+	return names;
+}
+
+FJwRpcJson UJwRpcJsonLibrary::GetItem(const FJwRpcJson& json, int index)
+{
+	const TArray<TSharedPtr<FJsonValue>>* pArray = nullptr;
+	if (json.Value && json.Value->TryGetArray(pArray) && pArray->IsValidIndex(index))
+		return FJwRpcJson((*pArray)[index]);
+
+	return FJwRpcJson();
+}
+
+int UJwRpcJsonLibrary::Num(const FJwRpcJson& json)
+{
+	const TArray<TSharedPtr<FJsonValue>>* pArray = nullptr;
+	if (json.Value && json.Value->TryGetArray(pArray))
+		return pArray->Num();
+
+	return 0;
+}
+
+FString UJwRpcJsonLibrary::ToString(const FJwRpcJson& json, bool bPretty)
+{
+	return json.Value ? HelperStringifyJSON(json.Value, bPretty) : FString();
+}
+
+FJwRpcJson UJwRpcJsonLibrary::Parse(const FString& string)
+{
+	//the serializer only reads objects and arrays at the root, so the value is wrapped in an array
+	TArray<TSharedPtr<FJsonValue>> wrapper;
+	TSharedRef<TJsonReader<>> reader = TJsonReaderFactory<>::Create(TEXT("[") + string + TEXT("]"));
+	if (!FJsonSerializer::Deserialize(reader, wrapper) || wrapper.Num() != 1)
+		return FJwRpcJson();
+
+	return FJwRpcJson(wrapper[0]);
+}
+
+UJsonValue* UJwRpcJsonLibrary::ToJsonValue(const FJwRpcJson& json)
+{
+	return json.Value ? UJsonValue::MakeFromCPPVersion(json.Value) : nullptr;
+}
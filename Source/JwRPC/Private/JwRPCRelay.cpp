@@ -0,0 +1,296 @@
+// Copyright 1998-2018 Epic Games, Inc. All Rights Reserved.
+
+#include "JwRPCRelay.h"
+#include "JwRPCFrameScan.h"
+
+//the message is escaped as a json string
+static FString MakeErrorRespond(const FString& rawId, const FJwRPCError& error)
+{
+	const FString message = UJwRpcJsonLibrary::ToString(FJwRpcJson(MakeShared<FJsonValueString>(error.Message)));
+	return FString::Printf(TEXT(R"({"id":%s,"error":{"code":%d,"message":%s}})"), *rawId, error.Code, *message);
+}
+
+UJwRpcRelay* UJwRpcRelay::CreateRelay(UJwRpcConnection* target)
+{
+	if (!target)
+		return nullptr;
+
+	static uint32 RelayCounter = 0;
+
+	UJwRpcRelay* pRelay = NewObject<UJwRpcRelay>((UObject*)GetTransientPackage(), NAME_None, RF_Transient);
+	pRelay->Target = target;
+	pRelay->IdPrefix = FString::Printf(TEXT("~%u."), ++RelayCounter);
+
+	target->AddRawMessageFilter(UJwRpcConnection::FRawMessageFilter::CreateUObject(pRelay, &UJwRpcRelay::OnTargetMessage));
+	target->AddCloseObserver(UJwRpcConnection::FOnClosed::CreateUObject(pRelay, &UJwRpcRelay::OnTargetClosed));
+	return pRelay;
+}
+
+void UJwRpcRelay::AddSource(UJwRpcConnection* source)
+{
+	if (!source || Sources.Contains(source))
+		return;
+
+	Sources.Add(source);
+
+	source->AddRawMessageFilter(UJwRpcConnection::FRawMessageFilter::CreateUObject(this, &UJwRpcRelay::OnSourceMessage, TWeakObjectPtr<UJwRpcConnection>(source)));
+	source->AddCloseObserver(UJwRpcConnection::FOnClosed::CreateUObject(this, &UJwRpcRelay::OnSourceClosed, TWeakObjectPtr<UJwRpcConnection>(source)));
+}
+
+void UJwRpcRelay::RemoveSource(UJwRpcConnection* source)
+{
+	if (!Sources.Contains(source))
+		return;
+
+	UnbindSource(source);
+
+	TArray<uint32> removed;
+	for (const auto& pair : Pending)
+	{
+		if (pair.Value.Source == source)
+			removed.Add(pair.Key);
+	}
+
+	for (uint32 key : removed)
+		FailPending(key, FJwRPCError::NoConnection, true);
+}
+
+void UJwRpcRelay::AllowMethod(const FString& method)
+{
+	Methods.Add(method);
+}
+
+void UJwRpcRelay::AllowPrefix(const FString& prefix)
+{
+	Prefixes.AddUnique(prefix);
+}
+
+void UJwRpcRelay::Close()
+{
+	FailAll(FJwRPCError::NoConnection, true);
+
+	for (UJwRpcConnection* pSource : Sources)
+	{
+		if (pSource)
+		{
+			pSource->RemoveRawMessageFilters(this);
+			pSource->RemoveCloseObservers(this);
+		}
+	}
+
+	if (Target)
+	{
+		Target->RemoveRawMessageFilters(this);
+		Target->RemoveCloseObservers(this);
+	}
+
+	Sources.Reset();
+	Target = nullptr;
+}
+
+void UJwRpcRelay::BeginDestroy()
+{
+	//the filters and observers are bound weakly, the connections skip them once we are gone
+	Pending.Reset();
+	ExpireHeap.Reset();
+
+	Super::BeginDestroy();
+}
+
+bool UJwRpcRelay::IsAllowed(const FString& method) const
+{
+	if (Methods.Contains(method))
+		return true;
+
+	for (const FString& prefix : Prefixes)
+	{
+		if (method.StartsWith(prefix, ESearchCase::CaseSensitive))
+			return true;
+	}
+
+	return false;
+}
+
+FString UJwRpcRelay::MakeTargetId(uint32 key) const
+{
+	return FString::Printf(TEXT("\"%s%u\""), *IdPrefix, key);
+}
+
+bool UJwRpcRelay::OnSourceMessage(const FString& data, TWeakObjectPtr<UJwRpcConnection> source)
+{
+	FJwRpcFrameScan scan;
+	if (!JwRpcScanFrame(data, scan) || !scan.bHasMethod || !IsAllowed(scan.Method))
+		return false;
+
+	UJwRpcConnection* pSource = source.Get();
+	const bool bTargetConnected = Target && Target->IsConnected();
+
+	//notifications are copied as they are
+	if (scan.IdStart == INDEX_NONE)
+	{
+		if (bTargetConnected)
+		{
+			Target->Send(data, Target->GetLane(EJwRpcLane::ByMethod, scan.Method));
+			NumForwarded++;
+		}
+		return true;
+	}
+
+	const FString sourceId = data.Mid(scan.IdStart, scan.IdEnd - scan.IdStart);
+
+	if (!bTargetConnected)
+	{
+		if (pSource)
+			pSource->Send(MakeErrorRespond(sourceId, FJwRPCError::NoConnection));
+		return true;
+	}
+
+	const uint32 key = NextKey++;
+
+	FPendingRequest& pending = Pending.Add(key);
+	pending.Source = source;
+	pending.SourceId = sourceId;
+	pending.ExpireTime = FPlatformTime::Seconds() + Timeout;
+	ExpireHeap.HeapPush(FExpireEntry{ pending.ExpireTime, key });
+
+	Target->Send(data.Left(scan.IdStart) + MakeTargetId(key) + data.Mid(scan.IdEnd), Target->GetLane(EJwRpcLane::ByMethod, scan.Method));
+	NumForwarded++;
+	return true;
+}
+
+bool UJwRpcRelay::OnTargetMessage(const FString& data)
+{
+	//responds with our prefix are consumed even if their request has expired already
+	FJwRpcFrameScan scan;
+	if (!JwRpcScanFrame(data, scan) || scan.bHasMethod || scan.IdStart == INDEX_NONE)
+		return false;
+
+	//only the ids we made. "<prefix><key>"
+	const TCHAR* pId = *data + scan.IdStart;
+	const int32 idLen = scan.IdEnd - scan.IdStart;
+	if (idLen < IdPrefix.Len() + 3 || pId[0] != TCHAR('"') || FCString::Strncmp(pId + 1, *IdPrefix, IdPrefix.Len()) != 0)
+		return false;
+
+	const uint32 key = (uint32)FCString::Strtoui64(pId + 1 + IdPrefix.Len(), nullptr, 10);
+
+	//a respond of a request that has already failed is dropped
+	FPendingRequest pending;
+	if (Pending.RemoveAndCopyValue(key, pending))
+	{
+		if (UJwRpcConnection* pSource = pending.Source.Get())
+			pSource->Send(data.Left(scan.IdStart) + pending.SourceId + data.Mid(scan.IdEnd));
+	}
+
+	CompactExpireHeap();
+	return true;
+}
+
+void UJwRpcRelay::FailPending(uint32 key, const FJwRPCError& error, bool bCancelOnTarget)
+{
+	FPendingRequest pending;
+	if (!Pending.RemoveAndCopyValue(key, pending))
+		return;
+
+	if (UJwRpcConnection* pSource = pending.Source.Get())
+		pSource->Send(MakeErrorRespond(pending.SourceId, error));
+
+	//so the target can stop working on it
+	if (bCancelOnTarget && Target && Target->IsConnected())
+		Target->Notify(Target->CancelMethod, FString::Printf(TEXT(R"({"id":%s})"), *MakeTargetId(key)));
+}
+
+void UJwRpcRelay::FailAll(const FJwRPCError& error, bool bCancelOnTarget)
+{
+	TArray<uint32> keys;
+	Pending.GetKeys(keys);
+
+	for (uint32 key : keys)
+		FailPending(key, error, bCancelOnTarget);
+
+	ExpireHeap.Reset();
+}
+
+void UJwRpcRelay::CompactExpireHeap()
+{
+	if (Pending.Num() == 0)
+	{
+		ExpireHeap.Reset();
+		return;
+	}
+
+	if (ExpireHeap.Num() < 64 || ExpireHeap.Num() < Pending.Num() * 2)
+		return;
+
+	ExpireHeap.Reset();
+	for (const auto& pair : Pending)
+		ExpireHeap.Add(FExpireEntry{ pair.Value.ExpireTime, pair.Key });
+	ExpireHeap.Heapify();
+}
+
+void UJwRpcRelay::OnTargetClosed(int32 StatusCode, const FString& Reason, bool bWasClean)
+{
+	//the target lost the requests with its connection. new ones are answered by OnSourceMessage till it is back
+	if (Pending.Num())
+	{
+		UE_LOG(LogJwRPC, Warning, TEXT("relay target disconnected, failing %d requests"), Pending.Num());
+		FailAll(FJwRPCError::NoConnection, false);
+	}
+}
+
+void UJwRpcRelay::OnSourceClosed(int32 StatusCode, const FString& Reason, bool bWasClean, TWeakObjectPtr<UJwRpcConnection> source)
+{
+	UJwRpcConnection* pSource = source.Get();
+
+	TArray<uint32> lost;
+	for (const auto& pair : Pending)
+	{
+		if (pair.Value.Source == source)
+			lost.Add(pair.Key);
+	}
+
+	for (uint32 key : lost)
+		FailPending(key, FJwRPCError::NoConnection, true);
+	CompactExpireHeap();
+
+	//e.g clients of UJwRpcServer, they never come back
+	if (pSource && !pSource->bAutoReconnectEnabled)
+		UnbindSource(pSource);
+}
+
+void UJwRpcRelay::UnbindSource(UJwRpcConnection* source)
+{
+	Sources.Remove(source);
+
+	if (source)
+	{
+		source->RemoveRawMessageFilters(this);
+		source->RemoveCloseObservers(this);
+	}
+}
+
+void UJwRpcRelay::Tick(float DeltaTime)
+{
+	//requests are failed in the order they expire, whatever timeout they were forwarded with
+	const double now = FPlatformTime::Seconds();
+	while (ExpireHeap.Num() && ExpireHeap.HeapTop().ExpireTime <= now)
+	{
+		FExpireEntry entry;
+		ExpireHeap.HeapPop(entry, false);
+
+		//answered already or failed by other means
+		FailPending(entry.Key, FJwRPCError::Timeout, true);
+	}
+
+	CompactExpireHeap();
+}
+
+bool UJwRpcRelay::IsTickable() const
+{
+	//nothing to do till the next request expires, closing is observed
+	return !IsTemplate() && ExpireHeap.Num() > 0 && ExpireHeap.HeapTop().ExpireTime <= FPlatformTime::Seconds();
+}
+
+TStatId UJwRpcRelay::GetStatId() const
+{
+	return TStatId();
+}
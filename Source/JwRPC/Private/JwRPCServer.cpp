@@ -0,0 +1,459 @@
+// Copyright 1998-2018 Epic Games, Inc. All Rights Reserved.
+
+#include "JwRPCServer.h"
+#include "IWebSocketNetworkingModule.h"
+#include "WebSocketNetworkingDelegates.h"
+#include "JsonBP.h"
+#include "JwRPCFrameScan.h"
+
+//ids of the acknowledgement requests. connections make numeric ids, so they never collide
+static const TCHAR* AckIdPrefix = TEXT("$/ack:");
+
+FJwRpcServerClientSocket::FJwRpcServerClientSocket(INetworkingWebSocket* socket) : Socket(socket)
+{
+	bConnected = true;
+	RemoteAddress = Socket->RemoteEndPoint(true);
+
+	Socket->SetReceiveCallBack(FWebSocketPacketRecievedCallBack::CreateRaw(this, &FJwRpcServerClientSocket::OnReceive));
+	Socket->SetErrorCallBack(FWebSocketInfoCallBack::CreateRaw(this, &FJwRpcServerClientSocket::OnSocketClosed));
+#if ENGINE_MAJOR_VERSION > 4 || ENGINE_MINOR_VERSION >= 26
+	Socket->SetSocketClosedCallBack(FWebSocketInfoCallBack::CreateRaw(this, &FJwRpcServerClientSocket::OnSocketClosed));
+#endif
+}
+
+FJwRpcServerClientSocket::~FJwRpcServerClientSocket()
+{
+	Release();
+}
+
+void FJwRpcServerClientSocket::Connect()
+{
+	if (bConnected)
+		ConnectedEvent.Broadcast();
+	else
+		ConnectionErrorEvent.Broadcast(TEXT("client is disconnected"));
+}
+
+void FJwRpcServerClientSocket::Close(int32 Code, const FString& Reason)
+{
+	//the socket itself is deleted by the server, we may be inside one of its callbacks
+	if (bConnected)
+	{
+		bConnected = false;
+		ResetQueue();
+		ClosedEvent.Broadcast(Code, Reason, true);
+	}
+}
+
+void FJwRpcServerClientSocket::ResetQueue()
+{
+	Queue.Reset();
+	Head = 0;
+	QueuedBytes = 0;
+	AckMarks.Reset();
+	UnackedBytes = 0;
+	BytesSinceAck = 0;
+}
+
+void FJwRpcServerClientSocket::Send(const FString& Data)
+{
+	FTCHARToUTF8 converted(*Data);
+	SendShared(MakeShared<TArray<uint8>>((const uint8*)converted.Get(), converted.Length()));
+}
+
+void FJwRpcServerClientSocket::SendShared(const FJwRpcSharedFrame& frame)
+{
+	if (!bConnected)
+		return;
+
+	Queue.Add(FQueuedFrame{ frame, FPlatformTime::Seconds() });
+	QueuedBytes += frame->Num();
+}
+
+bool FJwRpcServerClientSocket::Flush(int64 bytesBudget, int64 sendWindow, int64 maxQueuedBytes, float maxQueueWait)
+{
+	if (!Socket || !bConnected)
+		return true;
+
+	int64 budget = bytesBudget;
+	while (Head < Queue.Num() && (bytesBudget <= 0 || budget > 0) && (sendWindow <= 0 || UnackedBytes < sendWindow))
+	{
+		const TArray<uint8>& data = *Queue[Head].Data;
+		Socket->Send(data.GetData(), data.Num(), false);
+
+		budget -= data.Num();
+		QueuedBytes -= data.Num();
+		Head++;
+
+		if (sendWindow > 0)
+		{
+			UnackedBytes += data.Num();
+			BytesSinceAck += data.Num();
+		}
+	}
+
+	if (sendWindow > 0 && BytesSinceAck >= sendWindow / 4)
+	{
+		FAckMark mark;
+		mark.Id = NextAckId++;
+		mark.Bytes = BytesSinceAck;
+		AckMarks.Add(mark);
+		BytesSinceAck = 0;
+
+		const FString request = FString::Printf(TEXT(R"({"id":"%s%u","method":"$/ping","params":{}})"), AckIdPrefix, mark.Id);
+		FTCHARToUTF8 converted(*request);
+		Socket->Send((const uint8*)converted.Get(), converted.Length(), false);
+	}
+
+	if (Head == Queue.Num())
+	{
+		Queue.Reset();
+		Head = 0;
+		return true;
+	}
+
+	//drop the sent items once they are the majority
+	if (Head > Queue.Num() / 2)
+	{
+		Queue.RemoveAt(0, Head, false);
+		Head = 0;
+	}
+
+	if (maxQueuedBytes > 0 && QueuedBytes > maxQueuedBytes)
+		return false;
+	if (maxQueueWait > 0 && FPlatformTime::Seconds() - Queue[Head].QueueTime > maxQueueWait)
+		return false;
+
+	return true;
+}
+
+void FJwRpcServerClientSocket::Release()
+{
+	bConnected = false;
+	ResetQueue();
+
+	if (Socket)
+	{
+		delete Socket;
+		Socket = nullptr;
+	}
+}
+
+void FJwRpcServerClientSocket::OnReceive(void* data, int32 size)
+{
+	FUTF8ToTCHAR converted((const ANSICHAR*)data, size);
+	FString message(converted.Length(), converted.Get());
+	if (!HandleAck(message))
+		MessageEvent.Broadcast(message);
+}
+
+bool FJwRpcServerClientSocket::HandleAck(const FString& message)
+{
+	if (AckMarks.Num() == 0)
+		return false;
+
+	//only a respond whose id is exactly one of ours, anything else goes to the connection
+	FJwRpcFrameScan scan;
+	if (!JwRpcScanFrame(message, scan) || scan.bHasMethod || scan.IdStart == INDEX_NONE)
+		return false;
+
+	const int32 prefixLen = FCString::Strlen(AckIdPrefix);
+	const int32 digitsStart = scan.IdStart + 1 + prefixLen;
+	const int32 digitsEnd = scan.IdEnd - 1;
+	if (message[scan.IdStart] != TCHAR('"') || digitsEnd <= digitsStart || FCString::Strncmp(*message + scan.IdStart + 1, AckIdPrefix, prefixLen) != 0)
+		return false;
+	for (int32 i = digitsStart; i < digitsEnd; i++)
+	{
+		if (!FChar::IsDigit(message[i]))
+			return false;
+	}
+
+	//the client reads in order, so the respond acknowledges the older marks too
+	const uint32 id = (uint32)FCString::Strtoui64(*message + digitsStart, nullptr, 10);
+	const int index = AckMarks.IndexOfByPredicate([id](const FAckMark& mark) { return mark.Id == id; });
+	for (int i = 0; i <= index; i++)
+		UnackedBytes -= AckMarks[i].Bytes;
+	if (index != INDEX_NONE)
+		AckMarks.RemoveAt(0, index + 1, false);
+
+	return true;
+}
+
+void FJwRpcServerClientSocket::OnSocketClosed()
+{
+	if (bConnected)
+	{
+		bConnected = false;
+		ResetQueue();
+		ClosedEvent.Broadcast(1006, TEXT("client disconnected"), false);
+	}
+}
+
+UJwRpcServer* UJwRpcServer::Listen(int port, TSubclassOf<UJwRpcConnection> clientClass)
+{
+	IWebSocketNetworkingModule* pModule = FModuleManager::Get().LoadModulePtr<IWebSocketNetworkingModule>(TEXT("WebSocketNetworking"));
+	if (!pModule)
+	{
+		UE_LOG(LogJwRPC, Error, TEXT("WebSocketNetworking module is not available"));
+		return nullptr;
+	}
+
+	UJwRpcServer* pServer = NewObject<UJwRpcServer>((UObject*)GetTransientPackage(), NAME_None, RF_Transient);
+	pServer->ClientClass = clientClass ? clientClass : TSubclassOf<UJwRpcConnection>(UJwRpcConnection::StaticClass());
+	pServer->Server = pModule->CreateServer();
+
+	if (!pServer->Server || !pServer->Server->Init(port, FWebSocketClientConnectedCallBack::CreateUObject(pServer, &UJwRpcServer::OnClientSocket)))
+	{
+		UE_LOG(LogJwRPC, Error, TEXT("failed to listen on port %d"), port);
+		pServer->Server.Reset();
+		return nullptr;
+	}
+
+	UE_LOG(LogJwRPC, Log, TEXT("listening on port %d"), port);
+	return pServer;
+}
+
+void UJwRpcServer::Stop()
+{
+	//the server can't be destroyed while its servicing
+	if (bTicking)
+	{
+		bStopPending = true;
+		return;
+	}
+
+	bStopPending = false;
+
+	for (int i = Clients.Num() - 1; i >= 0; i--)
+	{
+		if (Clients[i])
+			Clients[i]->Close(1001, TEXT("server stopped"));
+		else
+			ClientSockets[i]->Close(1001, TEXT("server stopped"));
+	}
+
+	while (Clients.Num())
+		RemoveClient(Clients.Num() - 1);
+
+	Server.Reset();
+}
+
+void UJwRpcServer::DisconnectClient(UJwRpcConnection* client, int code, const FString& reason)
+{
+	//removed in the next tick
+	const int index = Clients.Find(client);
+	if (index != INDEX_NONE)
+		ClientSockets[index]->Close(code, reason);
+}
+
+void UJwRpcServer::SetClientSendLimits(int maxQueuedBytes, float maxQueueWait, int bytesPerTick, int sendWindow)
+{
+	MaxClientQueuedBytes = maxQueuedBytes;
+	MaxClientQueueWait = maxQueueWait;
+	ClientBytesPerTick = bytesPerTick;
+	ClientSendWindow = sendWindow;
+}
+
+void UJwRpcServer::RegisterCallback(const FString& method, const UJwRpcConnection::FMethodData& md)
+{
+	RegisteredCallbacks.Add(method, md);
+
+	for (UJwRpcConnection* pClient : Clients)
+	{
+		if (pClient)
+			pClient->RegisteredCallbacks.Add(method, md);
+	}
+}
+
+void UJwRpcServer::RegisterNotificationCallback(const FString& method, UJwRpcConnection::FNotifyCB callback)
+{
+	UJwRpcConnection::FMethodData md;
+	md.bIsNotification = true;
+	md.NotifyCB = callback;
+	RegisterCallback(method, md);
+}
+
+void UJwRpcServer::RegisterRequestCallback(const FString& method, UJwRpcConnection::FRequestCB callback)
+{
+	UJwRpcConnection::FMethodData md;
+	md.bIsNotification = false;
+	md.RequestCB = callback;
+	RegisterCallback(method, md);
+}
+
+void UJwRpcServer::K2_RegisterNotificationCallback(const FString& method, FNotificationDD callback)
+{
+	UJwRpcConnection::FMethodData md;
+	md.bIsNotification = true;
+	md.BPNotifyCB = callback;
+	RegisterCallback(method, md);
+}
+
+void UJwRpcServer::K2_RegisterRequestCallback(const FString& method, FRequestDD callback)
+{
+	UJwRpcConnection::FMethodData md;
+	md.bIsNotification = false;
+	md.BPRequestCB = callback;
+	RegisterCallback(method, md);
+}
+
+FJwRpcSharedFrame UJwRpcServer::EncodeNotification(const FString& method, const FString& params)
+{
+	const FString message = FString::Printf(TEXT(R"({"method":"%s","params":%s})"), *method, params.IsEmpty() ? TEXT("null") : *params);
+	FTCHARToUTF8 converted(*message);
+	return MakeShared<TArray<uint8>>((const uint8*)converted.Get(), converted.Length());
+}
+
+void UJwRpcServer::Notify(const FString& method, TSharedPtr<FJsonValue> params)
+{
+	Notify(method, params ? HelperStringifyJSON(params) : FString());
+}
+
+void UJwRpcServer::Notify(const FString& method, const FString& params)
+{
+	if (ClientSockets.Num() == 0)
+		return;
+
+	const FJwRpcSharedFrame frame = EncodeNotification(method, params);
+	for (const TSharedPtr<FJwRpcServerClientSocket>& socket : ClientSockets)
+		socket->SendShared(frame);
+}
+
+void UJwRpcServer::NotifyClients(const TArray<UJwRpcConnection*>& clients, const FString& method, TSharedPtr<FJsonValue> params)
+{
+	NotifyClients(clients, method, params ? HelperStringifyJSON(params) : FString());
+}
+
+void UJwRpcServer::NotifyClients(const TArray<UJwRpcConnection*>& clients, const FString& method, const FString& params)
+{
+	if (clients.Num() == 0)
+		return;
+
+	const FJwRpcSharedFrame frame = EncodeNotification(method, params);
+	for (UJwRpcConnection* pClient : clients)
+	{
+		const int index = Clients.Find(pClient);
+		if (index != INDEX_NONE)
+			ClientSockets[index]->SendShared(frame);
+	}
+}
+
+void UJwRpcServer::K2_Notify(const FString& method, const FString& params)
+{
+	Notify(method, params);
+}
+
+void UJwRpcServer::K2_NotifyJSON(const FString& method, const FJwRpcJson& params)
+{
+	Notify(method, params.Value);
+}
+
+void UJwRpcServer::K2_NotifyClientsJSON(const TArray<UJwRpcConnection*>& clients, const FString& method, const FJwRpcJson& params)
+{
+	NotifyClients(clients, method, params.Value);
+}
+
+void UJwRpcServer::OnClientConnected(UJwRpcConnection* client)
+{
+	OnClientConnectedEvent.ExecuteIfBound(client);
+	K2_OnClientConnected(client);
+}
+
+void UJwRpcServer::OnClientDisconnected(UJwRpcConnection* client)
+{
+	OnClientDisconnectedEvent.ExecuteIfBound(client);
+	K2_OnClientDisconnected(client);
+}
+
+void UJwRpcServer::OnClientSocket(INetworkingWebSocket* socket)
+{
+	TSharedRef<FJwRpcServerClientSocket> clientSocket = MakeShared<FJwRpcServerClientSocket>(socket);
+
+	UJwRpcConnection* pConn = NewObject<UJwRpcConnection>((UObject*)GetTransientPackage(), ClientClass, NAME_None, RF_Transient);
+	//there is nothing to reconnect to, a client that comes back is a new connection
+	pConn->bAutoReconnectEnabled = false;
+	pConn->RegisteredCallbacks.Append(RegisteredCallbacks);
+	pConn->Register();
+	pConn->BindSocket(clientSocket);
+	pConn->bConnecting = true;
+	pConn->LastConnectAttempTime = 0;
+
+	Clients.Add(pConn);
+	ClientSockets.Add(clientSocket);
+
+	UE_LOG(LogJwRPC, Log, TEXT("client connected %s"), *clientSocket->GetRemoteAddress());
+
+	clientSocket->Connect();
+	OnClientConnected(pConn);
+}
+
+void UJwRpcServer::RemoveClient(int index)
+{
+	UJwRpcConnection* pClient = Clients[index];
+	TSharedPtr<FJwRpcServerClientSocket> socket = ClientSockets[index];
+	Clients.RemoveAt(index);
+	ClientSockets.RemoveAt(index);
+
+	socket->Release();
+
+	if (pClient)
+		OnClientDisconnected(pClient);
+}
+
+void UJwRpcServer::Tick(float DeltaTime)
+{
+	bTicking = true;
+
+	//accepts the new clients and dispatches the received messages
+	Server->Tick();
+
+	for (int i = Clients.Num() - 1; i >= 0; i--)
+	{
+		//callbacks may have removed clients
+		if (!ClientSockets.IsValidIndex(i))
+			continue;
+
+		FJwRpcServerClientSocket* pSocket = ClientSockets[i].Get();
+		if (!pSocket->Flush(ClientBytesPerTick, ClientSendWindow, MaxClientQueuedBytes, MaxClientQueueWait))
+		{
+			UE_LOG(LogJwRPC, Warning, TEXT("evicting slow client %s queued bytes:%lld unacknowledged bytes:%lld"), *pSocket->GetRemoteAddress(), pSocket->GetQueuedBytes(), pSocket->GetUnackedBytes());
+			NumEvictedClients++;
+
+			if (Clients[i])
+				Clients[i]->Close(1008, TEXT("slow consumer"));
+			else
+				pSocket->Close(1008, TEXT("slow consumer"));
+		}
+
+		if (ClientSockets.IsValidIndex(i) && !ClientSockets[i]->IsConnected())
+			RemoveClient(i);
+	}
+
+	bTicking = false;
+
+	if (bStopPending)
+		Stop();
+}
+
+bool UJwRpcServer::IsTickable() const
+{
+	return !IsTemplate() && Server.IsValid();
+}
+
+TStatId UJwRpcServer::GetStatId() const
+{
+	return TStatId();
+}
+
+void UJwRpcServer::BeginDestroy()
+{
+	//the clients may already be destroyed, so no events here
+	for (const TSharedPtr<FJwRpcServerClientSocket>& socket : ClientSockets)
+		socket->Release();
+
+	ClientSockets.Reset();
+	Clients.Reset();
+	Server.Reset();
+
+	Super::BeginDestroy();
+}
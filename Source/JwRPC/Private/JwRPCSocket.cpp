@@ -0,0 +1,9 @@
+// Copyright 1998-2018 Epic Games, Inc. All Rights Reserved.
+
+#include "JwRPCSocket.h"
+
+void FJwRpcSocketBase::Send(const void* Data, SIZE_T Size, bool bIsBinary)
+{
+	FUTF8ToTCHAR converted((const ANSICHAR*)Data, (int32)Size);
+	Send(FString(converted.Length(), converted.Get()));
+}
@@ -0,0 +1,905 @@
+// Copyright 1998-2018 Epic Games, Inc. All Rights Reserved.
+
+#include "JwRPCStreamSocket.h"
+#include "JwRPC.h"
+#include "HAL/RunnableThread.h"
+#include "HAL/PlatformProcess.h"
+#include "Containers/Queue.h"
+#include "Async/Async.h"
+#include "Sockets.h"
+#include "SocketSubsystem.h"
+#include "IPAddress.h"
+#include "AddressInfoTypes.h"
+#include "Serialization/JsonReader.h"
+#include "Serialization/JsonSerializer.h"
+#include "Policies/CondensedJsonPrintPolicy.h"
+
+#if PLATFORM_LINUX || PLATFORM_MAC
+#define JWRPC_WITH_UNIX_SOCKETS 1
+THIRD_PARTY_INCLUDES_START
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+THIRD_PARTY_INCLUDES_END
+#else
+#define JWRPC_WITH_UNIX_SOCKETS 0
+#endif
+
+//messages bigger than this are considered a broken stream
+static const uint32 MaxStreamFrameSize = 16 * 1024 * 1024;
+//how long the IO thread sleeps when there is nothing to do. it wakes up as soon as data arrives
+static const float StreamIdleWait = 0.02f;
+//connecting is given up after this many seconds
+static const double StreamConnectTimeout = 10;
+
+struct FJwRpcStreamAddress
+{
+	bool bUnix = false;
+	FString Path;
+	FString Host;
+	int32 Port = 0;
+
+	static bool Parse(const FString& url, FJwRpcStreamAddress& out)
+	{
+		static const FString UnixScheme(TEXT("unix://"));
+		static const FString TcpScheme(TEXT("tcp://"));
+
+		if (url.StartsWith(UnixScheme))
+		{
+			out.bUnix = true;
+			out.Path = url.Mid(UnixScheme.Len());
+			return !out.Path.IsEmpty();
+		}
+
+		if (url.StartsWith(TcpScheme))
+		{
+			FString port;
+			if (!url.Mid(TcpScheme.Len()).Split(TEXT(":"), &out.Host, &port, ESearchCase::IgnoreCase, ESearchDir::FromEnd))
+				return false;
+
+			out.bUnix = false;
+			out.Port = FCString::Atoi(*port);
+			return !out.Host.IsEmpty() && out.Port > 0;
+		}
+
+		return false;
+	}
+};
+
+/*
+non-blocking byte stream. used by the IO thread.
+*/
+class FJwRpcStream
+{
+public:
+	virtual ~FJwRpcStream() {}
+	//waits till the stream is readable, or writable too if bWrite. returns when the time is over
+	virtual void Wait(bool bWrite, float seconds) = 0;
+	//returns number of bytes read, 0 if nothing is available, -1 if the stream is closed or failed
+	virtual int32 Recv(uint8* data, int32 size) = 0;
+	//returns number of bytes written, 0 if it would block, -1 on failure
+	virtual int32 Send(const uint8* data, int32 size) = 0;
+};
+
+class FJwRpcStreamListener
+{
+public:
+	virtual ~FJwRpcStreamListener() {}
+	//returns a connected stream or null if there is no pending connection
+	virtual FJwRpcStream* Accept() = 0;
+};
+
+class FJwRpcTcpStream : public FJwRpcStream
+{
+public:
+	explicit FJwRpcTcpStream(FSocket* socket) : Socket(socket) {}
+
+	virtual ~FJwRpcTcpStream()
+	{
+		Socket->Close();
+		ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->DestroySocket(Socket);
+	}
+
+	virtual void Wait(bool bWrite, float seconds) override
+	{
+		Socket->Wait(bWrite ? ESocketWaitConditions::WaitForReadOrWrite : ESocketWaitConditions::WaitForRead, FTimespan::FromSeconds(seconds));
+	}
+
+	virtual int32 Recv(uint8* data, int32 size) override
+	{
+		//true with nothing read means no data yet, false is a graceful close or an error.
+		//errno is not set by a graceful close, so the last error code can't tell them apart
+		int32 read = 0;
+		return Socket->Recv(data, size, read) ? read : -1;
+	}
+
+	virtual int32 Send(const uint8* data, int32 size) override
+	{
+		int32 sent = 0;
+		if (Socket->Send(data, size, sent))
+			return sent;
+
+		return ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->GetLastErrorCode() == SE_EWOULDBLOCK ? 0 : -1;
+	}
+
+	static TSharedPtr<FInternetAddr> Resolve(const FJwRpcStreamAddress& address, FString& outError)
+	{
+		ISocketSubsystem* pSSS = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM);
+
+		TSharedPtr<FInternetAddr> addr = pSSS->CreateInternetAddr();
+		bool bValid = false;
+		addr->SetIp(*address.Host, bValid);
+		if (!bValid)
+		{
+			FAddressInfoResult info = pSSS->GetAddressInfo(*address.Host, nullptr, EAddressInfoFlags::Default, NAME_None, ESocketType::SOCKTYPE_Streaming);
+			if (info.ReturnCode != SE_NO_ERROR || info.Results.Num() == 0)
+			{
+				outError = FString::Printf(TEXT("failed to resolve %s"), *address.Host);
+				return nullptr;
+			}
+			addr = info.Results[0].Address;
+		}
+
+		addr->SetPort(address.Port);
+		return addr;
+	}
+
+	static FJwRpcStream* Connect(const FJwRpcStreamAddress& address, const FThreadSafeBool& bStop, FString& outError)
+	{
+		TSharedPtr<FInternetAddr> addr = Resolve(address, outError);
+		if (!addr)
+			return nullptr;
+
+		ISocketSubsystem* pSSS = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM);
+		FSocket* pSocket = pSSS->CreateSocket(NAME_Stream, TEXT("JwRPC stream"), addr->GetProtocolType());
+		if (!pSocket)
+		{
+			outError = TEXT("failed to create socket");
+			return nullptr;
+		}
+
+		pSocket->SetNoDelay(true);
+		pSocket->SetNonBlocking(true);
+
+		//connecting without blocking so that closing the socket doesn't wait for the OS timeout
+		ESocketConnectionState state = SCS_ConnectionError;
+		if (pSocket->Connect(*addr) || pSSS->GetLastErrorCode() == SE_EINPROGRESS)
+		{
+			const double deadline = FPlatformTime::Seconds() + StreamConnectTimeout;
+			for (;;)
+			{
+				state = pSocket->GetConnectionState();
+				if (state != SCS_NotConnected || bStop || FPlatformTime::Seconds() >= deadline)
+					break;
+				pSocket->Wait(ESocketWaitConditions::WaitForWrite, FTimespan::FromSeconds(StreamIdleWait));
+			}
+		}
+
+		if (state != SCS_Connected)
+		{
+			outError = FString::Printf(TEXT("failed to connect to %s"), *addr->ToString(true));
+			pSSS->DestroySocket(pSocket);
+			return nullptr;
+		}
+
+		return new FJwRpcTcpStream(pSocket);
+	}
+
+private:
+	FSocket* Socket;
+};
+
+class FJwRpcTcpListener : public FJwRpcStreamListener
+{
+public:
+	explicit FJwRpcTcpListener(FSocket* socket) : Socket(socket) {}
+
+	virtual ~FJwRpcTcpListener()
+	{
+		Socket->Close();
+		ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->DestroySocket(Socket);
+	}
+
+	virtual FJwRpcStream* Accept() override
+	{
+		bool bPending = false;
+		if (!Socket->HasPendingConnection(bPending) || !bPending)
+			return nullptr;
+
+		FSocket* pClient = Socket->Accept(TEXT("JwRPC stream client"));
+		if (!pClient)
+			return nullptr;
+
+		pClient->SetNoDelay(true);
+		pClient->SetNonBlocking(true);
+		return new FJwRpcTcpStream(pClient);
+	}
+
+	static FJwRpcStreamListener* Listen(const FJwRpcStreamAddress& address, FString& outError)
+	{
+		TSharedPtr<FInternetAddr> addr = FJwRpcTcpStream::Resolve(address, outError);
+		if (!addr)
+			return nullptr;
+
+		ISocketSubsystem* pSSS = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM);
+		FSocket* pSocket = pSSS->CreateSocket(NAME_Stream, TEXT("JwRPC stream listener"), addr->GetProtocolType());
+		if (!pSocket)
+		{
+			outError = TEXT("failed to create socket");
+			return nullptr;
+		}
+
+		pSocket->SetReuseAddr(true);
+		if (!pSocket->Bind(*addr) || !pSocket->Listen(8))
+		{
+			outError = FString::Printf(TEXT("failed to listen on %s"), *addr->ToString(true));
+			pSSS->DestroySocket(pSocket);
+			return nullptr;
+		}
+
+		pSocket->SetNonBlocking(true);
+		return new FJwRpcTcpListener(pSocket);
+	}
+
+private:
+	FSocket* Socket;
+};
+
+#if JWRPC_WITH_UNIX_SOCKETS
+
+#ifdef MSG_NOSIGNAL
+static const int UnixSendFlags = MSG_NOSIGNAL;
+#else
+static const int UnixSendFlags = 0;
+#endif
+
+static void SetupUnixSocket(int fd)
+{
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+}
+
+static bool MakeUnixAddress(const FString& path, sockaddr_un& outAddr, FString& outError)
+{
+	FTCHARToUTF8 pathUtf8(*path);
+	FMemory::Memzero(outAddr);
+	if (pathUtf8.Length() >= (int32)sizeof(outAddr.sun_path))
+	{
+		outError = FString::Printf(TEXT("socket path is too long: %s"), *path);
+		return false;
+	}
+
+	outAddr.sun_family = AF_UNIX;
+	FMemory::Memcpy(outAddr.sun_path, pathUtf8.Get(), pathUtf8.Length());
+	return true;
+}
+
+class FJwRpcUnixStream : public FJwRpcStream
+{
+public:
+	explicit FJwRpcUnixStream(int fd) : Fd(fd) {}
+
+	virtual ~FJwRpcUnixStream()
+	{
+		close(Fd);
+	}
+
+	virtual void Wait(bool bWrite, float seconds) override
+	{
+		pollfd pfd;
+		pfd.fd = Fd;
+		pfd.events = POLLIN | (bWrite ? POLLOUT : 0);
+		pfd.revents = 0;
+		poll(&pfd, 1, (int)(seconds * 1000));
+	}
+
+	virtual int32 Recv(uint8* data, int32 size) override
+	{
+		const ssize_t read = recv(Fd, data, size, 0);
+		if (read > 0)
+			return (int32)read;
+		if (read == 0)
+			return -1;
+		return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+	}
+
+	virtual int32 Send(const uint8* data, int32 size) override
+	{
+		const ssize_t sent = send(Fd, data, size, UnixSendFlags);
+		if (sent >= 0)
+			return (int32)sent;
+		return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+	}
+
+	static FJwRpcStream* Connect(const FJwRpcStreamAddress& address, const FThreadSafeBool& bStop, FString& outError)
+	{
+		sockaddr_un addr;
+		if (!MakeUnixAddress(address.Path, addr, outError))
+			return nullptr;
+
+		const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+		{
+			outError = TEXT("failed to create socket");
+			return nullptr;
+		}
+
+		SetupUnixSocket(fd);
+
+		//EAGAIN means the backlog of the listener is full, the connect is retried till it is accepted
+		const double deadline = FPlatformTime::Seconds() + StreamConnectTimeout;
+		int error = connect(fd, (const sockaddr*)&addr, sizeof(addr)) == 0 ? 0 : errno;
+		while ((error == EAGAIN || error == EINPROGRESS || error == EINTR) && !bStop && FPlatformTime::Seconds() < deadline)
+		{
+			if (error != EINPROGRESS)
+			{
+				FPlatformProcess::Sleep(StreamIdleWait);
+				error = connect(fd, (const sockaddr*)&addr, sizeof(addr)) == 0 ? 0 : errno;
+				continue;
+			}
+
+			pollfd pfd;
+			pfd.fd = fd;
+			pfd.events = POLLOUT;
+			pfd.revents = 0;
+			if (poll(&pfd, 1, (int)(StreamIdleWait * 1000)) > 0)
+			{
+				socklen_t len = sizeof(error);
+				if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0)
+					error = errno;
+			}
+		}
+
+		if (error != 0)
+		{
+			outError = FString::Printf(TEXT("failed to connect to %s errno:%d"), *address.Path, error);
+			close(fd);
+			return nullptr;
+		}
+
+		return new FJwRpcUnixStream(fd);
+	}
+
+private:
+	int Fd;
+};
+
+class FJwRpcUnixListener : public FJwRpcStreamListener
+{
+public:
+	FJwRpcUnixListener(int fd, const FString& path) : Fd(fd), Path(path) {}
+
+	virtual ~FJwRpcUnixListener()
+	{
+		close(Fd);
+		unlink(TCHAR_TO_UTF8(*Path));
+	}
+
+	virtual FJwRpcStream* Accept() override
+	{
+		const int fd = accept(Fd, nullptr, nullptr);
+		if (fd < 0)
+			return nullptr;
+
+		SetupUnixSocket(fd);
+		return new FJwRpcUnixStream(fd);
+	}
+
+	static FJwRpcStreamListener* Listen(const FJwRpcStreamAddress& address, FString& outError)
+	{
+		sockaddr_un addr;
+		if (!MakeUnixAddress(address.Path, addr, outError))
+			return nullptr;
+
+		const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+		{
+			outError = TEXT("failed to create socket");
+			return nullptr;
+		}
+
+		//a stale socket file of a previous run would fail the bind
+		unlink(addr.sun_path);
+		if (bind(fd, (const sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 8) != 0)
+		{
+			outError = FString::Printf(TEXT("failed to listen on %s errno:%d"), *address.Path, errno);
+			close(fd);
+			return nullptr;
+		}
+
+		SetupUnixSocket(fd);
+		return new FJwRpcUnixListener(fd, address.Path);
+	}
+
+private:
+	int Fd;
+	FString Path;
+};
+
+#endif //JWRPC_WITH_UNIX_SOCKETS
+
+//gives up when bStop is set
+static FJwRpcStream* ConnectStream(const FJwRpcStreamAddress& address, const FThreadSafeBool& bStop, FString& outError)
+{
+	if (!address.bUnix)
+		return FJwRpcTcpStream::Connect(address, bStop, outError);
+
+#if JWRPC_WITH_UNIX_SOCKETS
+	return FJwRpcUnixStream::Connect(address, bStop, outError);
+#else
+	outError = TEXT("unix sockets are not supported on this platform");
+	return nullptr;
+#endif
+}
+
+static FJwRpcStreamListener* ListenStream(const FJwRpcStreamAddress& address, FString& outError)
+{
+	if (!address.bUnix)
+		return FJwRpcTcpListener::Listen(address, outError);
+
+#if JWRPC_WITH_UNIX_SOCKETS
+	return FJwRpcUnixListener::Listen(address, outError);
+#else
+	outError = TEXT("unix sockets are not supported on this platform");
+	return nullptr;
+#endif
+}
+
+//appends a size prefixed frame
+static void AppendStreamFrame(TArray<uint8>& out, const FString& message)
+{
+	FTCHARToUTF8 converted(*message);
+	const uint32 size = (uint32)converted.Length();
+	const uint8 header[4] = { (uint8)(size >> 24), (uint8)(size >> 16), (uint8)(size >> 8), (uint8)size };
+
+	out.Append(header, 4);
+	out.Append((const uint8*)converted.Get(), size);
+}
+
+//removes the complete frames from the buffer. returns false if the stream is broken
+static bool ExtractStreamFrames(TArray<uint8>& buffer, TArray<FString>& outMessages)
+{
+	int32 offset = 0;
+	while (buffer.Num() - offset >= 4)
+	{
+		const uint8* pHeader = buffer.GetData() + offset;
+		const uint32 size = ((uint32)pHeader[0] << 24) | ((uint32)pHeader[1] << 16) | ((uint32)pHeader[2] << 8) | (uint32)pHeader[3];
+		if (size > MaxStreamFrameSize)
+			return false;
+
+		if ((uint32)(buffer.Num() - offset - 4) < size)
+			break;
+
+		FUTF8ToTCHAR converted((const ANSICHAR*)(pHeader + 4), (int32)size);
+		outMessages.Emplace(converted.Length(), converted.Get());
+		offset += 4 + size;
+	}
+
+	if (offset)
+		buffer.RemoveAt(0, offset, false);
+
+	return true;
+}
+
+/*
+state shared between the game thread and the IO thread of a FJwRpcStreamSocket
+*/
+struct FJwRpcStreamChannel : public TSharedFromThis<FJwRpcStreamChannel, ESPMode::ThreadSafe>
+{
+	FJwRpcStreamAddress Address;
+	FThreadSafeBool bStop;
+	FThreadSafeBool bSendFailed;
+
+	//guards Stream and PendingSend. the game thread writes directly and leaves the rest to the IO thread
+	FCriticalSection SendLock;
+	FJwRpcStream* Stream = nullptr;
+	TArray<uint8> PendingSend;
+
+	TQueue<FJwRpcStreamEvent, EQueueMode::Spsc> Events;
+	FThreadSafeCounter DrainPosted;
+	//only touched on the game thread
+	FJwRpcStreamSocket* Owner = nullptr;
+
+	//IO thread
+	void PushEvent(FJwRpcStreamEvent::EType type, const FString& data = FString())
+	{
+		FJwRpcStreamEvent event;
+		event.Type = type;
+		event.Data = data;
+		Events.Enqueue(MoveTemp(event));
+
+		//one task drains everything that is queued till it runs
+		if (DrainPosted.Set(1) == 0)
+		{
+			TWeakPtr<FJwRpcStreamChannel, ESPMode::ThreadSafe> weakThis = AsShared();
+			AsyncTask(ENamedThreads::GameThread, [weakThis]() {
+				if (TSharedPtr<FJwRpcStreamChannel, ESPMode::ThreadSafe> pinned = weakThis.Pin())
+					pinned->Drain();
+			});
+		}
+	}
+
+	//game thread
+	void Drain()
+	{
+		DrainPosted.Set(0);
+
+		FJwRpcStreamEvent event;
+		while (Owner && Events.Dequeue(event))
+			Owner->HandleEvent(event);
+	}
+
+	//any thread
+	void Send(const TArray<uint8>& frame)
+	{
+		FScopeLock lock(&SendLock);
+		PendingSend.Append(frame);
+		if (Stream)
+			FlushPending();
+	}
+
+	//writes as much as the stream accepts. SendLock must be held
+	void FlushPending()
+	{
+		int32 offset = 0;
+		while (offset < PendingSend.Num())
+		{
+			const int32 sent = Stream->Send(PendingSend.GetData() + offset, PendingSend.Num() - offset);
+			if (sent < 0)
+			{
+				bSendFailed = true;
+				break;
+			}
+			if (sent == 0)
+				break;
+			offset += sent;
+		}
+
+		if (offset)
+			PendingSend.RemoveAt(0, offset, false);
+	}
+};
+
+class FJwRpcStreamWorker : public FRunnable
+{
+public:
+	explicit FJwRpcStreamWorker(TSharedRef<FJwRpcStreamChannel, ESPMode::ThreadSafe> channel) : Channel(channel) {}
+
+	virtual void Stop() override
+	{
+		Channel->bStop = true;
+	}
+
+	virtual uint32 Run() override
+	{
+		FString error;
+		FJwRpcStream* pStream = ConnectStream(Channel->Address, Channel->bStop, error);
+		if (!pStream)
+		{
+			if (Channel->bStop)
+				return 0;
+			Channel->PushEvent(FJwRpcStreamEvent::ConnectionError, error);
+			return 0;
+		}
+
+		{
+			FScopeLock lock(&Channel->SendLock);
+			Channel->Stream = pStream;
+			Channel->FlushPending();
+		}
+		Channel->PushEvent(FJwRpcStreamEvent::Connected);
+
+		TArray<uint8> chunk;
+		chunk.SetNumUninitialized(64 * 1024);
+		TArray<uint8> received;
+		TArray<FString> messages;
+		FString closeReason;
+
+		while (!Channel->bStop)
+		{
+			bool bHasPending;
+			{
+				FScopeLock lock(&Channel->SendLock);
+				bHasPending = Channel->PendingSend.Num() > 0;
+			}
+
+			pStream->Wait(bHasPending, StreamIdleWait);
+
+			if (bHasPending)
+			{
+				FScopeLock lock(&Channel->SendLock);
+				Channel->FlushPending();
+			}
+
+			if (Channel->bSendFailed)
+			{
+				closeReason = TEXT("send failed");
+				break;
+			}
+
+			bool bLost = false;
+			for (;;)
+			{
+				const int32 read = pStream->Recv(chunk.GetData(), chunk.Num());
+				if (read < 0)
+					bLost = true;
+				if (read <= 0)
+					break;
+				received.Append(chunk.GetData(), read);
+			}
+
+			messages.Reset();
+			if (!ExtractStreamFrames(received, messages))
+			{
+				closeReason = TEXT("invalid frame");
+				break;
+			}
+
+			for (FString& message : messages)
+				Channel->PushEvent(FJwRpcStreamEvent::Message, message);
+
+			if (bLost)
+			{
+				closeReason = TEXT("connection lost");
+				break;
+			}
+		}
+
+		{
+			FScopeLock lock(&Channel->SendLock);
+			Channel->Stream = nullptr;
+			Channel->PendingSend.Reset();
+		}
+		delete pStream;
+
+		//closing by the game thread is reported by the socket itself
+		if (!Channel->bStop)
+			Channel->PushEvent(FJwRpcStreamEvent::Closed, closeReason);
+
+		return 0;
+	}
+
+private:
+	TSharedRef<FJwRpcStreamChannel, ESPMode::ThreadSafe> Channel;
+};
+
+bool FJwRpcStreamSocket::IsStreamURL(const FString& url)
+{
+	return url.StartsWith(TEXT("tcp://")) || url.StartsWith(TEXT("unix://"));
+}
+
+FJwRpcStreamSocket::FJwRpcStreamSocket(const FString& url) : URL(url)
+{
+}
+
+FJwRpcStreamSocket::~FJwRpcStreamSocket()
+{
+	StopWorker();
+}
+
+void FJwRpcStreamSocket::Connect()
+{
+	if (Channel)
+		return;
+
+	FJwRpcStreamAddress address;
+	if (!FJwRpcStreamAddress::Parse(URL, address))
+	{
+		ConnectionErrorEvent.Broadcast(FString::Printf(TEXT("invalid url %s"), *URL));
+		return;
+	}
+
+	Channel = MakeShared<FJwRpcStreamChannel, ESPMode::ThreadSafe>();
+	Channel->Address = address;
+	Channel->Owner = this;
+
+	Worker = new FJwRpcStreamWorker(Channel.ToSharedRef());
+	Thread = FRunnableThread::Create(Worker, TEXT("JwRPCStream"));
+}
+
+void FJwRpcStreamSocket::Close(int32 Code, const FString& Reason)
+{
+	StopWorker();
+
+	if (bConnected)
+	{
+		bConnected = false;
+		ClosedEvent.Broadcast(Code, Reason, true);
+	}
+}
+
+void FJwRpcStreamSocket::Send(const FString& Data)
+{
+	if (!Channel)
+		return;
+
+	TArray<uint8> frame;
+	AppendStreamFrame(frame, Data);
+	Channel->Send(frame);
+}
+
+void FJwRpcStreamSocket::HandleEvent(const FJwRpcStreamEvent& event)
+{
+	switch (event.Type)
+	{
+	case FJwRpcStreamEvent::Connected:
+		bConnected = true;
+		ConnectedEvent.Broadcast();
+		break;
+
+	case FJwRpcStreamEvent::ConnectionError:
+		StopWorker();
+		ConnectionErrorEvent.Broadcast(event.Data);
+		break;
+
+	case FJwRpcStreamEvent::Message:
+		MessageEvent.Broadcast(event.Data);
+		break;
+
+	case FJwRpcStreamEvent::Closed:
+		StopWorker();
+		bConnected = false;
+		ClosedEvent.Broadcast(1006, event.Data, false);
+		break;
+	}
+}
+
+void FJwRpcStreamSocket::StopWorker()
+{
+	if (!Channel)
+		return;
+
+	//the IO thread never blocks longer than StreamIdleWait, so joining it doesn't stall the game thread
+	Channel->Owner = nullptr;
+	Channel->bStop = true;
+
+	if (Thread)
+	{
+		Thread->Kill(true);
+		delete Thread;
+		Thread = nullptr;
+	}
+
+	delete Worker;
+	Worker = nullptr;
+	Channel = nullptr;
+}
+
+TUniquePtr<FJwRpcStreamEchoServer> FJwRpcStreamEchoServer::Start(const FString& url)
+{
+	FJwRpcStreamAddress address;
+	if (!FJwRpcStreamAddress::Parse(url, address))
+	{
+		UE_LOG(LogJwRPC, Error, TEXT("invalid url %s"), *url);
+		return nullptr;
+	}
+
+	FString error;
+	FJwRpcStreamListener* pListener = ListenStream(address, error);
+	if (!pListener)
+	{
+		UE_LOG(LogJwRPC, Error, TEXT("echo server failed. %s"), *error);
+		return nullptr;
+	}
+
+	TUniquePtr<FJwRpcStreamEchoServer> server(new FJwRpcStreamEchoServer());
+	server->Listener = pListener;
+	server->Thread = FRunnableThread::Create(server.Get(), TEXT("JwRPCStreamEcho"));
+	return server;
+}
+
+FJwRpcStreamEchoServer::~FJwRpcStreamEchoServer()
+{
+	bStop = true;
+	if (Thread)
+	{
+		Thread->Kill(true);
+		delete Thread;
+	}
+
+	delete Listener;
+}
+
+uint32 FJwRpcStreamEchoServer::Run()
+{
+	static FString STR_method("method");
+	static FString STR_id("id");
+	static FString STR_params("params");
+	static FString STR_result("result");
+
+	struct FClient
+	{
+		TUniquePtr<FJwRpcStream> Stream;
+		TArray<uint8> Received;
+	};
+
+	TArray<FClient> clients;
+	TArray<uint8> chunk;
+	chunk.SetNumUninitialized(64 * 1024);
+	TArray<FString> messages;
+	TArray<uint8> replies;
+
+	while (!bStop)
+	{
+		while (FJwRpcStream* pAccepted = Listener->Accept())
+		{
+			FClient client;
+			client.Stream.Reset(pAccepted);
+			clients.Add(MoveTemp(client));
+		}
+
+		bool bIdle = true;
+
+		for (int i = clients.Num() - 1; i >= 0; i--)
+		{
+			FClient& client = clients[i];
+
+			bool bLost = false;
+			for (;;)
+			{
+				const int32 read = client.Stream->Recv(chunk.GetData(), chunk.Num());
+				if (read < 0)
+					bLost = true;
+				if (read <= 0)
+					break;
+				client.Received.Append(chunk.GetData(), read);
+				bIdle = false;
+			}
+
+			messages.Reset();
+			replies.Reset();
+			if (!ExtractStreamFrames(client.Received, messages))
+				bLost = true;
+
+			for (const FString& message : messages)
+			{
+				TSharedPtr<FJsonObject> root;
+				TSharedRef<TJsonReader<>> reader = TJsonReaderFactory<>::Create(message);
+				if (!FJsonSerializer::Deserialize(reader, root) || !root.IsValid() || !root->HasField(STR_method))
+					continue;
+
+				if (!root->HasField(STR_id))
+				{
+					AppendStreamFrame(replies, message);
+					continue;
+				}
+
+				TSharedRef<FJsonObject> reply = MakeShared<FJsonObject>();
+				reply->SetField(STR_id, root->TryGetField(STR_id));
+				TSharedPtr<FJsonValue> params = root->TryGetField(STR_params);
+				reply->SetField(STR_result, params.IsValid() ? params : MakeShared<FJsonValueNull>());
+
+				FString replyString;
+				TSharedRef<TJsonWriter<TCHAR, TCondensedJsonPrintPolicy<TCHAR>>> writer = TJsonWriterFactory<TCHAR, TCondensedJsonPrintPolicy<TCHAR>>::Create(&replyString);
+				FJsonSerializer::Serialize(reply, writer);
+				AppendStreamFrame(replies, replyString);
+			}
+
+			//a test peer, so it simply spins till everything is written
+			int32 offset = 0;
+			while (!bLost && offset < replies.Num() && !bStop)
+			{
+				const int32 sent = client.Stream->Send(replies.GetData() + offset, replies.Num() - offset);
+				if (sent < 0)
+					bLost = true;
+				else if (sent == 0)
+					client.Stream->Wait(true, 0.001f);
+				offset += FMath::Max(0, sent);
+			}
+
+			if (bLost)
+				clients.RemoveAt(i);
+		}
+
+		if (bIdle)
+			FPlatformProcess::Sleep(0.001f);
+	}
+
+	return 0;
+}
@@ -0,0 +1,62 @@
+// Copyright 1998-2018 Epic Games, Inc. All Rights Reserved.
+
+#include "JwRPCSubsystem.h"
+#include "JwRPC.h"
+#include "Engine/Engine.h"
+
+UJwRpcSubsystem* UJwRpcSubsystem::Get()
+{
+	return GEngine ? GEngine->GetEngineSubsystem<UJwRpcSubsystem>() : nullptr;
+}
+
+void UJwRpcSubsystem::Register(UJwRpcConnection* connection)
+{
+	Connections.Add(connection);
+}
+
+void UJwRpcSubsystem::Unregister(UJwRpcConnection* connection)
+{
+	//its wake entries are skipped once the weak pointer is invalid
+	Connections.Remove(connection);
+}
+
+void UJwRpcSubsystem::Schedule(UJwRpcConnection* connection, float wakeTime, uint32 serial)
+{
+	WakeHeap.HeapPush(FWakeEntry{ wakeTime, serial, connection });
+}
+
+void UJwRpcSubsystem::Tick(float DeltaTime)
+{
+	const float now = UJwRpcConnection::GetTime();
+
+	//connections rescheduled while updating are not picked again in this frame
+	DueEntries.Reset();
+	while (WakeHeap.Num() && WakeHeap.HeapTop().WakeTime <= now && (MaxUpdatesPerFrame <= 0 || DueEntries.Num() < MaxUpdatesPerFrame))
+	{
+		FWakeEntry entry;
+		WakeHeap.HeapPop(entry, false);
+
+		UJwRpcConnection* pConn = entry.Connection.Get();
+		if (pConn && pConn->bWakeScheduled && pConn->WakeSerial == entry.Serial)
+		{
+			pConn->bWakeScheduled = false;
+			DueEntries.Add(entry);
+		}
+	}
+
+	for (const FWakeEntry& entry : DueEntries)
+	{
+		if (UJwRpcConnection* pConn = entry.Connection.Get())
+			pConn->Update();
+	}
+}
+
+bool UJwRpcSubsystem::IsTickable() const
+{
+	return !IsTemplate() && WakeHeap.Num() > 0;
+}
+
+TStatId UJwRpcSubsystem::GetStatId() const
+{
+	return TStatId();
+}
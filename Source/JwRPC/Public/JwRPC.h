@@ -7,7 +7,7 @@
 #include "Kismet/BlueprintFunctionLibrary.h"
 #include "JsonValue.h"
 #include "IWebSocket.h"
-#include "Tickable.h"
+#include "JwRPCJson.h"
 
 #include "JwRPC.generated.h"
 
@@ -16,6 +16,9 @@ DECLARE_LOG_CATEGORY_EXTERN(LogJwRPC, Log, All);
 
 class UJwRpcConnection;
 class UJsonValue;
+class FJwRpcTrafficRecorder;
+class FJwRpcFuture;
+struct FJwRpcCall;
 
 class JWRPC_API FJwRPCModule : public IModuleInterface
 {
@@ -46,16 +49,105 @@ struct JWRPC_API FJwRPCError
 	static FJwRPCError ServerError;
 	static FJwRPCError Timeout;
 	static FJwRPCError NoConnection;
+	static FJwRPCError RequestCancelled;
+	static FJwRPCError Overloaded;
 };
 
 
 
 
+/*
+outgoing messages are sent by lanes. realtime messages are written immediately,
+normal and bulk ones may wait if their lane has used its byte budget of the current tick.
+*/
+UENUM(BlueprintType)
+enum class EJwRpcLane : uint8
+{
+	Realtime,
+	Normal,
+	Bulk,
+	//the lane registered for the method by SetMethodLane, Normal if there is none
+	ByMethod,
+};
+
+USTRUCT(BlueprintType)
+struct JWRPC_API FJwRpcLaneStats
+{
+	GENERATED_BODY()
+
+	//messages waiting to be written
+	UPROPERTY(BlueprintReadOnly)
+	int QueuedMessages = 0;
+	UPROPERTY(BlueprintReadOnly)
+	int64 QueuedBytes = 0;
+	//seconds the oldest queued message has been waiting
+	UPROPERTY(BlueprintReadOnly)
+	float OldestWait = 0;
+	UPROPERTY(BlueprintReadOnly)
+	float MaxWait = 0;
+	UPROPERTY(BlueprintReadOnly)
+	float AverageWait = 0;
+	UPROPERTY(BlueprintReadOnly)
+	int64 SentMessages = 0;
+	UPROPERTY(BlueprintReadOnly)
+	int64 SentBytes = 0;
+};
+
 DECLARE_DYNAMIC_DELEGATE_OneParam(FOnRPCResult, const FString&, result);
-DECLARE_DYNAMIC_DELEGATE_OneParam(FOnRPCResultJSON, const UJsonValue*, result);
+DECLARE_DYNAMIC_DELEGATE_OneParam(FOnRPCResultJSON, const FJwRpcJson&, result);
 DECLARE_DYNAMIC_DELEGATE_OneParam(FOnRPCError, const FJwRPCError&, error);
 
-DECLARE_DYNAMIC_DELEGATE_TwoParams(FNotificationDD, UJwRpcConnection*, connection, const UJsonValue*, params);
+DECLARE_DYNAMIC_DELEGATE_TwoParams(FNotificationDD, UJwRpcConnection*, connection, const FJwRpcJson&, params);
+
+/*
+handle to a request we have sent. returned by Request() and can be used to cancel it.
+*/
+USTRUCT(BlueprintType)
+struct JWRPC_API FJwRpcRequestHandle
+{
+	GENERATED_BODY()
+
+	UPROPERTY(BlueprintReadOnly)
+	FString Id;
+	UPROPERTY(BlueprintReadOnly)
+	TWeakObjectPtr<UJwRpcConnection> Connection;
+
+	//whether the request is still waiting for its respond
+	bool IsPending() const;
+	/*
+	forget the request. none of its callbacks will be called after this.
+	@param bNotifyPeer	- whether to send a '$/cancelRequest' notification so the peer can abort its work
+	@return false if the request was not pending anymore
+	*/
+	bool Cancel(bool bNotifyPeer = true) const;
+};
+
+//responds to a JSON-RPC batch the peer has sent. they are written as one array once all of its requests are finished
+struct FJwRpcIncomingBatch
+{
+	TArray<FString> Responds;
+	//requests of the batch that are not finished yet
+	int Remaining = 0;
+	//false while the batch is being dispatched, more requests may still join it
+	bool bDispatched = false;
+	//set when the connection is closed, its responds can't be sent anymore
+	bool bDropped = false;
+	//the most urgent lane of its responds
+	EJwRpcLane Lane = EJwRpcLane::Bulk;
+};
+
+//state shared between all the copies of an incoming request handle
+struct FJwRpcIncomingRequestState
+{
+	FString Method;
+	//the batch the request came in, null if it came alone
+	TSharedPtr<FJwRpcIncomingBatch> Batch;
+	//set when the peer cancels the request or the connection is closed
+	bool bCancelled = false;
+	bool bFinished = false;
+	//whether the handler is invoked. false while the request waits in the queue
+	bool bAdmitted = false;
+};
 
 USTRUCT(BlueprintType)
 struct JWRPC_API FJwRpcIncomingRequest
@@ -67,14 +159,25 @@ struct JWRPC_API FJwRpcIncomingRequest
 	UPROPERTY(BlueprintReadOnly)
 	TWeakObjectPtr<UJwRpcConnection> Connection;
 
+	TSharedPtr<FJwRpcIncomingRequestState> State;
+
+	/*
+	whether the peer has cancelled this request. long running handlers should poll this and finish early,
+	usually by FinishError(FJwRPCError::RequestCancelled).
+	*/
+	bool IsCancelled() const;
 
 	void FinishError(const FJwRPCError& error) const;
 	void FinishError(int code, const FString& message = "") const;
 	void FinishSuccess(TSharedPtr<FJsonValue> result) const;
 	void FinishSuccess(const FString& result) const;
+
+protected:
+	//marks the request as finished. returns false if it was already finished
+	bool MarkFinished() const;
 };
 
-DECLARE_DYNAMIC_DELEGATE_ThreeParams(FRequestDD, UJwRpcConnection*, connection, UJsonValue*, params,  const FJwRpcIncomingRequest&, requestHandle);
+DECLARE_DYNAMIC_DELEGATE_ThreeParams(FRequestDD, UJwRpcConnection*, connection, const FJwRpcJson&, params,  const FJwRpcIncomingRequest&, requestHandle);
 
 DECLARE_DYNAMIC_DELEGATE(FOnConnectSuccess);
 DECLARE_DYNAMIC_DELEGATE_OneParam(FOnConnectFailed, const FString&, result);
@@ -88,9 +191,10 @@ an instance of this class represents a connection to server. most functions can
 you usually inherit from this class and add your own functions.
 then create an instance and connect to server by 'UJwRpcConnection::CreateAndConnect'
 
+connections don't tick themselves, UJwRpcSubsystem updates them only when they have something to do.
 */
 UCLASS(BlueprintType, Blueprintable)
-class JWRPC_API UJwRpcConnection : public UObject, public FTickableGameObject
+class JWRPC_API UJwRpcConnection : public UObject
 {
 	GENERATED_BODY()
 public:
@@ -117,22 +221,26 @@ public:
 	@param params		- the string containing any json value. object, array, string, number, ...
 	@param onSuccess	- callback to be called when result arrives
 	@param onError		- callback to be called if any type of error happened. 
+	@param lane			- priority of the message
+	@return handle that can be used to cancel the request
 	*/
-	void Request(const FString& method, const FString& params, FSuccessCB onSuccess = nullptr, FErrorCB onError = nullptr);
+	FJwRpcRequestHandle Request(const FString& method, const FString& params, FSuccessCB onSuccess = nullptr, FErrorCB onError = nullptr, EJwRpcLane lane = EJwRpcLane::ByMethod);
 	/*
 	send a request to the server.
 	@param method		- name of method
 	@param params		- the shared pointer contacting any json value. object, array, string, number, ...
 	@param onSuccess	- callback to be called when result arrives
 	@param onError		- callback to be called if any type of error happened.
+	@param lane			- priority of the message
+	@return handle that can be used to cancel the request
 	*/
-	void Request(const FString& method, TSharedPtr<FJsonValue> params, FSuccessCB onSuccess = nullptr, FErrorCB onError = nullptr);
+	FJwRpcRequestHandle Request(const FString& method, TSharedPtr<FJsonValue> params, FSuccessCB onSuccess = nullptr, FErrorCB onError = nullptr, EJwRpcLane lane = EJwRpcLane::ByMethod);
 	/*
 	template version that converts the result to a struct
 	*/
-	template<class TResultStruct, class TSuccess>  void Request_RS(const FString& method, const FString& params, TSuccess onSuccess, FErrorCB onError)
+	template<class TResultStruct, class TSuccess>  FJwRpcRequestHandle Request_RS(const FString& method, const FString& params, TSuccess onSuccess, FErrorCB onError)
 	{
-		this->Request(method, params, FSuccessCB::CreateLambda([onSuccess](TSharedPtr<FJsonValue> jsResult) {
+		return this->Request(method, params, FSuccessCB::CreateLambda([onSuccess](TSharedPtr<FJsonValue> jsResult) {
 
 			TResultStruct resultStruct;
 			if (FJsonObjectConverter::JsonObjectToUStruct<TResultStruct>(jsResult->AsObject().ToSharedRef(), &resultStruct))
@@ -141,9 +249,9 @@ public:
 			}
 		}), onError);
 	}
-	template<class TResultStruct, class TSuccess>  void Request_RS(const FString& method, TSharedPtr<FJsonValue> params, TSuccess onSuccess, FErrorCB onError)
+	template<class TResultStruct, class TSuccess>  FJwRpcRequestHandle Request_RS(const FString& method, TSharedPtr<FJsonValue> params, TSuccess onSuccess, FErrorCB onError)
 	{
-		this->Request(method, params, FSuccessCB::CreateLambda([onSuccess](TSharedPtr<FJsonValue> jsResult) {
+		return this->Request(method, params, FSuccessCB::CreateLambda([onSuccess](TSharedPtr<FJsonValue> jsResult) {
 
 			TResultStruct resultStruct;
 			if (FJsonObjectConverter::JsonObjectToUStruct<TResultStruct>(jsResult->AsObject().ToSharedRef(), &resultStruct))
@@ -155,26 +263,54 @@ public:
 	/*
 	for those who have no result
 	*/
-	void Request_RE(const FString& method, const FString& params, FEmptyCB onSuccess, FErrorCB onError)
+	FJwRpcRequestHandle Request_RE(const FString& method, const FString& params, FEmptyCB onSuccess, FErrorCB onError)
 	{
-		this->Request(method, params, FSuccessCB::CreateLambda([onSuccess](TSharedPtr<FJsonValue> jsResult) {
+		return this->Request(method, params, FSuccessCB::CreateLambda([onSuccess](TSharedPtr<FJsonValue> jsResult) {
 			onSuccess.ExecuteIfBound();
 		}), onError);
 	}
-	void Request_RE(const FString& method, TSharedPtr<FJsonValue> params, FEmptyCB onSuccess, FErrorCB onError)
+	FJwRpcRequestHandle Request_RE(const FString& method, TSharedPtr<FJsonValue> params, FEmptyCB onSuccess, FErrorCB onError)
 	{
-		this->Request(method, params, FSuccessCB::CreateLambda([onSuccess](TSharedPtr<FJsonValue> jsResult) {
+		return this->Request(method, params, FSuccessCB::CreateLambda([onSuccess](TSharedPtr<FJsonValue> jsResult) {
 			onSuccess.ExecuteIfBound();
 		}), onError);
 	}
 	/*
+	send a request and get its result as a future instead of callbacks. see FJwRpcFuture
+	*/
+	FJwRpcFuture RequestAsync(const FString& method, const FString& params, EJwRpcLane lane = EJwRpcLane::ByMethod);
+	FJwRpcFuture RequestAsync(const FString& method, TSharedPtr<FJsonValue> params, EJwRpcLane lane = EJwRpcLane::ByMethod);
+	/*
+	send the requests as one JSON-RPC batch, so they go out in a single write.
+	@param calls		- the requests
+	@param outFutures	- optional, receives the future of each request in the same order
+	@return ready when all of them are answered. see FJwRpcFuture::WhenAll
+	*/
+	FJwRpcFuture RequestAll(const TArray<FJwRpcCall>& calls, TArray<FJwRpcFuture>* outFutures = nullptr);
+	/*
+	requests and notifications sent between these are written as one JSON-RPC batch. FJwRpcBatchScope calls them.
+	the batch is queued on the most urgent lane of its messages.
+	*/
+	void BeginBatch();
+	void EndBatch();
+	/*
 	send a notification to server.
 	*/
-	void Notify(const FString& method, const FString& params);
+	void Notify(const FString& method, const FString& params, EJwRpcLane lane = EJwRpcLane::ByMethod);
 	/*
 	send a notification to server.
 	*/
-	void Notify(const FString& method, TSharedPtr<FJsonValue> params);
+	void Notify(const FString& method, TSharedPtr<FJsonValue> params, EJwRpcLane lane = EJwRpcLane::ByMethod);
+	/*
+	send a notification that only its latest params matter. e.g cursor or player position.
+	notifications are held till the next flush (see SetCoalesceRate), a newer call with the same method and key
+	replaces the params of the older one, which is never serialized.
+	@param method	- name of the method
+	@param params	- the shared pointer containing any json value
+	@param key		- optional sub key, so that different targets of the same method don't replace each other
+	*/
+	void NotifyCoalesced(const FString& method, TSharedPtr<FJsonValue> params, const FString& key = FString(), EJwRpcLane lane = EJwRpcLane::ByMethod);
+	void NotifyCoalesced(const FString& method, const FString& params, const FString& key = FString(), EJwRpcLane lane = EJwRpcLane::ByMethod);
 	/*
 	register a notification callback.
 	*/
@@ -184,6 +320,50 @@ public:
 	*/
 	void RegisterRequestCallback(const FString& method, FRequestCB callback);
 
+	/*
+	limit how many requests of a method are handled at the same time.
+	extra requests wait in a queue, they are answered by FJwRPCError::Overloaded if the queue is full or they wait too long.
+	@param method			- name of the method
+	@param maxConcurrent	- max number of unfinished requests. 0 means unlimited, the waiting requests are dispatched
+	@param maxQueued		- max number of requests waiting for a free slot. if lowered the newest extra ones are rejected
+	@param maxQueueWait		- max seconds a request may wait in the queue
+	*/
+	UFUNCTION(BlueprintCallable)
+	void SetRequestLimits(const FString& method, int maxConcurrent, int maxQueued = 32, float maxQueueWait = 5);
+	/*
+	name of the field in incoming requests that holds how many seconds the caller is willing to wait. e.g {"id":"1","method":"foo","timeout":2.5}
+	requests that can't be started before that are answered by FJwRPCError::Overloaded. empty disables it.
+	*/
+	UFUNCTION(BlueprintCallable)
+	void SetRequestDeadlineField(const FString& field);
+
+	/*
+	enable sending '$/ping' requests periodically. they keep the RTT estimate updated and detect dead connections.
+	the connection is dropped and reconnected if the peer doesn't respond to several heartbeats in a row.
+	@param interval		- seconds between two heartbeats. 0 disables it
+	@param maxMissed	- number of heartbeats in a row that may time out before the connection is considered dead
+	*/
+	UFUNCTION(BlueprintCallable)
+	void SetHeartbeat(float interval, int maxMissed = 3);
+	/*
+	derive request timeouts from the latencies we have observed for each method instead of the fixed default timeout.
+	@param percentile	- which percentile of the observed latencies to use. e.g 0.99
+	@param scale		- the percentile is multiplied by this
+	@param minTimeout	- timeout never gets lower than this (seconds)
+	*/
+	UFUNCTION(BlueprintCallable)
+	void SetAdaptiveTimeout(bool bEnable, float percentile = 0.99f, float scale = 3, float minTimeout = 1);
+
+	//smoothed round trip time in seconds measured by heartbeats. -1 if there is no sample yet
+	UFUNCTION(BlueprintPure)
+	float GetSmoothedRTT() const;
+	//mean deviation of round trip time in seconds
+	UFUNCTION(BlueprintPure)
+	float GetRTTVariance() const;
+	//percentile of the observed respond times of a method in seconds. -1 if there is no sample yet
+	UFUNCTION(BlueprintPure)
+	float GetLatencyPercentile(const FString& method, float percentile = 0.95f) const;
+
 	/*
 	send a notification to server.
 	@param	method	- name of the method
@@ -199,7 +379,7 @@ public:
 	@param onError		- callback to be called if any type of error happened.
 	*/
 	UFUNCTION(BlueprintCallable, meta=(DisplayName="Request (string)"))
-	void K2_Request(const FString& method, const FString& params, FOnRPCResult onSuccess, FOnRPCError onError);
+	FJwRpcRequestHandle K2_Request(const FString& method, const FString& params, FOnRPCResult onSuccess, FOnRPCError onError);
 	/*
 	send a notification to server.
 	@param	method	- name of the method
@@ -208,6 +388,19 @@ public:
 	UFUNCTION(BlueprintCallable, meta = (DisplayName = "Notify (json)"))
 	void K2_NotifyJSON(const FString& method, const UJsonValue* params);
 	/*
+	send a notification that only its latest params matter. see NotifyCoalesced
+	@param	method	- name of the method
+	@param	params	- json handle containing the params
+	@param	key		- optional sub key, so that different targets of the same method don't replace each other
+	*/
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "NotifyCoalesced"))
+	void K2_NotifyCoalesced(const FString& method, const FJwRpcJson& params, const FString& key);
+	/*
+	how many times per second coalesced notifications are sent. 0 sends them every tick
+	*/
+	UFUNCTION(BlueprintCallable)
+	void SetCoalesceRate(float flushPerSecond);
+	/*
 	send a request to the server.
 	@param method		- name of the requesting method
 	@param params		- the object containing any json value. object, array, string, number, ...
@@ -215,7 +408,7 @@ public:
 	@param onError		- callback to be called if any type of error happened.
 	*/
 	UFUNCTION(BlueprintCallable, meta = (DisplayName = "Request (json)"))
-	void K2_RequestJSON(const FString& method, const UJsonValue* params, FOnRPCResultJSON onSuccess, FOnRPCError onError);
+	FJwRpcRequestHandle K2_RequestJSON(const FString& method, const UJsonValue* params, FOnRPCResultJSON onSuccess, FOnRPCError onError);
 	/*
 	register a notification callback.
 	@param  method		name of the method
@@ -250,6 +443,41 @@ public:
 	*/
 	UFUNCTION(BlueprintCallable, meta = (DisplayName = "FinishSuccess"))
 	static void K2_IncomingRequestFinishSuccessJSON(const FJwRpcIncomingRequest& request, const UJsonValue* result);
+	/*
+	finish a pending request by sending result.
+	@param result	the json handle to be sent to the server
+	*/
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "FinishSuccess (json handle)"))
+	static void K2_IncomingRequestFinishSuccessHandle(const FJwRpcIncomingRequest& request, const FJwRpcJson& result);
+	/*
+	whether the peer has cancelled the incoming request. long running handlers should poll this.
+	*/
+	UFUNCTION(BlueprintPure, meta = (DisplayName = "IsCancelled"))
+	static bool K2_IsIncomingRequestCancelled(const FJwRpcIncomingRequest& request);
+
+	/*
+	cancel a request we have sent. its callbacks won't be called anymore.
+	@param bNotifyPeer	whether to tell the peer so it can abort its work
+	@return false if the request was not pending anymore
+	*/
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "CancelRequest"))
+	static bool K2_CancelRequest(const FJwRpcRequestHandle& request, bool bNotifyPeer = true);
+
+	/*
+	cancel a pending request by its id. see FJwRpcRequestHandle::Cancel
+	*/
+	bool CancelRequest(const FString& id, bool bNotifyPeer = true);
+	//whether the request with the specified id is waiting for respond
+	bool IsRequestPending(const FString& id) const;
+
+	DECLARE_DELEGATE_RetVal_OneParam(bool, FRawMessageFilter, const FString& /*data*/);
+	/*
+	add a function that sees the incoming messages before they are parsed. a filter returning true consumes the message.
+	UJwRpcRelay uses this to forward messages without parsing them.
+	*/
+	void AddRawMessageFilter(FRawMessageFilter filter);
+	//removes the filters bound to the object
+	void RemoveRawMessageFilters(const void* owner);
 
 
 	/*
@@ -270,7 +498,21 @@ public:
 	bool IsConnecting() const;
 
 	UFUNCTION(BlueprintCallable)
-	void Send(const FString& data);
+	void Send(const FString& data, EJwRpcLane lane = EJwRpcLane::Normal);
+
+	/*
+	set the lane used by requests, notifications and responds of a method when they don't specify one.
+	*/
+	UFUNCTION(BlueprintCallable)
+	void SetMethodLane(const FString& method, EJwRpcLane lane);
+	/*
+	max bytes (UTF-8, as written to the socket) a lane may write per tick. a message bigger than the budget is written when the budget is available
+	and the lane waits till the deficit is paid back. 0 means unlimited. realtime lane is never limited.
+	*/
+	UFUNCTION(BlueprintCallable)
+	void SetLaneBudget(EJwRpcLane lane, int bytesPerTick);
+	UFUNCTION(BlueprintPure)
+	FJwRpcLaneStats GetLaneStats(EJwRpcLane lane) const;
 
 
 
@@ -289,6 +531,20 @@ public:
 		return (TConnectionClass*)CreateAndConnect(url, TConnectionClass::StaticClass());
 	}
 
+	/*
+	create a connection over a custom transport instead of websocket. Connect() of the socket is called.
+	*/
+	static UJwRpcConnection* CreateWithSocket(TSharedRef<IWebSocket> socket, TSubclassOf<UJwRpcConnection> connectionClass);
+
+	/*
+	start writing all the incoming and outgoing messages to a binary file. see UJwRpcReplayer
+	@return false if the file can't be created
+	*/
+	UFUNCTION(BlueprintCallable)
+	bool StartCapture(const FString& filePath);
+	UFUNCTION(BlueprintCallable)
+	void StopCapture();
+
 	/*
 	this is called when we connect for the first time or reconnection happens.
 	this function may get called multiple times
@@ -312,6 +568,14 @@ public:
 	FOnConnected OnConnectedEvent;
 	FOnConnectionError OnConnectionErrorEvent;
 
+	/*
+	add a function that is called when the connection is closed, after its pending requests are failed.
+	unlike OnClosedEvent there can be many. UJwRpcRelay uses this to fail the requests it forwarded.
+	*/
+	void AddCloseObserver(FOnClosed observer);
+	//removes the observers bound to the object
+	void RemoveCloseObservers(const void* owner);
+
 	UFUNCTION(BlueprintImplementableEvent, meta=(DisplayName="OnConnected"))
 	void K2_OnConnected(bool bReconnect);
 	UFUNCTION(BlueprintImplementableEvent, meta = (DisplayName = "OnConnectionError"))
@@ -324,31 +588,99 @@ public:
 	void BeginDestroy() override;
 
 protected:
+	friend struct FJwRpcIncomingRequest;
+	friend class UJwRpcSubsystem;
+	friend class UJwRpcServer;
+	friend class UJwRpcFailoverConnection;
+	friend class UJwRpcRelay;
+
+	//seconds since the engine started. all the times of connections are based on this
+	static float GetTime();
+
 	//generates and returns a new id. 
 	FString GenId();
 	//this is called when we receive data from the server
 	void OnMessage(const FString& data);
+	//handles a single message, OnMessage splits the batches
+	void DispatchMessage(const TSharedPtr<FJsonObject>& JsonObject);
 	void InternalOnConnect();
 	void InternalOnConnectionError(const FString& error);
+	//creates the socket for SavedURL and binds its events
+	void CreateSocket();
+	void BindSocket(TSharedRef<IWebSocket> wsc);
+	//all outgoing messages are written to the socket by this
+	void WriteFrame(const FString& data);
+	/*
+	writes the message now or queues it, based on the lane.
+	@param requestIds	- ids of the requests in the message, so they can be taken out of the queue when cancelled
+	@param bBatch		- whether its a batch of many messages
+	*/
+	void SendOnLane(const FString& data, EJwRpcLane lane, const TArray<FString>& requestIds = TArray<FString>(), bool bBatch = false);
+	//adds a message to the current batch. requestId is empty for notifications
+	void AddToBatch(const FString& data, EJwRpcLane lane, const FString& requestId);
+	//removes a request that is queued but not written yet. outBatchLane is the lane of the batch if its queued in one
+	bool RemoveQueuedRequest(const FString& id, EJwRpcLane& outBatchLane);
+	//resolves ByMethod to the actual lane
+	EJwRpcLane GetLane(EJwRpcLane lane, const FString& method) const;
+	//gives the lanes the budget of the ticks passed since the last refill
+	void RefillLaneBudgets();
+	//writes queued messages of the lanes by priority as long as they have budget
+	void FlushLanes();
+	void ResetLanes();
+	//sends the latest params of coalesced notifications if its time
+	void FlushCoalesced();
+	//abandons the current socket as if it was closed. used when the peer is not responding
+	void DropSocket(int32 StatusCode, const FString& Reason);
 
 	//kill all pending requests or any kind of callback who is waiting to be called
 	void KillAll(const FJwRPCError& error);
 	void CheckExpiredRequests();
 
-	void Tick(float DeltaTime);
-	bool IsTickable() const override;
-	TStatId GetStatId() const override;
+	//called by UJwRpcSubsystem when the scheduled time has come
+	void Update();
+	//returns when Update() needs to be called next. MAX_flt if there is nothing to do
+	float GetNextUpdateTime() const;
+	//tells the subsystem when we need to be updated. should be called whenever something that needs updating is added
+	void ScheduleUpdate();
+	bool ShouldReconnect() const;
+	void Register();
 
 	void OnRequestRecv(TSharedPtr<FJsonObject> root);
+	//peer has cancelled one of the requests it sent us
+	void OnCancelRecv(TSharedPtr<FJsonValue> params);
+	//called by FJwRpcIncomingRequest when the handler sends the respond
+	void OnIncomingRequestFinished(const FJwRpcIncomingRequest& request);
+	//removes the request from IncomingRequests if the entry is this very request
+	bool RemoveIncomingRequest(const FJwRpcIncomingRequest& request);
+	//sends the respond of an incoming request, or adds it to the batch the request came in
+	void SendRespond(const FString& data, EJwRpcLane lane, const TSharedPtr<FJwRpcIncomingBatch>& batch);
+	//a request of the batch is finished or dropped. the batch is written once its the last one
+	void ReleaseBatchItem(const TSharedPtr<FJwRpcIncomingBatch>& batch);
+	//mark all incoming requests as cancelled, they can't be answered anymore
+	void CancelAllIncoming();
+	//runs the request now or queues it if its method has reached its limit
+	void AdmitRequest(TSharedPtr<FJsonObject> root, FJwRpcIncomingRequest& incReq);
+	//invokes the registered handler of the request
+	void DispatchRequest(TSharedPtr<FJsonObject> root, FJwRpcIncomingRequest& incReq);
+	//starts queued requests of the method while there are free slots
+	void PumpRequestQueue(const FString& method);
+	//rejects queued requests whose deadline has passed
+	void ExpireQueuedRequests();
+
+	void TickHeartbeat();
+	void OnHeartbeatResult(TSharedPtr<FJsonValue> result, double sendTime);
+	void OnHeartbeatError(const FJwRPCError& error, double sendTime);
+	void AddRTTSample(double rtt);
+	//timeout in seconds for a new request of the method
+	float GetRequestTimeout(const FString& method) const;
 
 	
 	int IdCounter = 0;
 	TSharedPtr<IWebSocket> Connection;
 	//default timeout in seconds
 	float DefaultTimeout = 60;
-	//
-	float TimeSinceStart = 0;
-	float LastExpireCheckTime = 0;
+	//earliest expire time of Requests and CancelledRequests. it may be earlier than the actual one but never later
+	float NextExpireTime = MAX_flt;
 	float LastDisconnectTime = 0;
 	float LastConnectAttempTime = 0;
 	float LastConnectionErrorTime = 0;
@@ -368,6 +700,8 @@ protected:
 		FErrorCB OnError;
 		FSuccessCB OnResult;
 		float ExpireTime;
+		//FPlatformTime::Seconds() when it was sent
+		double SendTime;
 	};
 
 	struct FMethodData
@@ -386,6 +720,144 @@ protected:
 
 	//requests waiting for respond
 	TMap<FString, FRequest> Requests;
+	//requests we have cancelled but their respond may still arrive. id -> expire time
+	TMap<FString, float> CancelledRequests;
+	//requests the peer has sent us and are not finished yet
+	TMap<FString, TSharedPtr<FJwRpcIncomingRequestState>> IncomingRequests;
+	//the batch being dispatched by OnMessage, its requests join it
+	TSharedPtr<FJwRpcIncomingBatch> IncomingBatch;
+	//name of the method used to cancel requests, in both directions
+	FString CancelMethod = TEXT("$/cancelRequest");
+
+	struct FQueuedRequest
+	{
+		TSharedPtr<FJsonObject> Root;
+		FJwRpcIncomingRequest Handle;
+		float Deadline;
+	};
+
+	struct FMethodLimits
+	{
+		int MaxConcurrent = 0;
+		int MaxQueued = 0;
+		float MaxQueueWait = 0;
+		//number of requests whose handler is invoked but not finished yet
+		int Running = 0;
+		bool bPumping = false;
+		TArray<FQueuedRequest> Queue;
+	};
+
+	//admission limits of incoming requests. method -> limits
+	TMap<FString, FMethodLimits> RequestLimits;
+	int NumQueuedRequests = 0;
+	//earliest deadline of the queued requests, may be earlier than the actual one
+	float NextQueueDeadline = MAX_flt;
+	FString DeadlineField;
+
+	FString HeartbeatMethod = TEXT("$/ping");
+	//seconds between heartbeats. 0 means disabled
+	float HeartbeatInterval = 0;
+	int HeartbeatMaxMissed = 3;
+	int MissedHeartbeats = 0;
+	bool bHeartbeatInFlight = false;
+	float LastHeartbeatTime = 0;
+
+	//seconds, -1 till the first sample
+	float SmoothedRTT = -1;
+	float RTTVariance = 0;
+
+	bool bAdaptiveTimeout = false;
+	float AdaptiveTimeoutPercentile = 0.99f;
+	float AdaptiveTimeoutScale = 3;
+	float AdaptiveTimeoutMin = 1;
+	//number of samples a method needs before its timeout becomes adaptive
+	int MinAdaptiveSamples = 16;
+
+	//ring buffer of the latest respond times of a method
+	struct FLatencyHistory
+	{
+		static const int MaxSamples = 64;
+
+		TArray<float> Samples;
+		int Next = 0;
+
+		void Add(float seconds);
+		float Percentile(float p) const;
+	};
+
+	//method -> respond times
+	TMap<FString, FLatencyHistory> Latencies;
+
+	bool bRegistered = false;
+	bool bWakeScheduled = false;
+	float ScheduledWakeTime = 0;
+	uint32 WakeSerial = 0;
+
+	struct FOutgoingFrame
+	{
+		FString Data;
+		double QueueTime;
+		//UTF-8 bytes
+		int64 Size;
+		TArray<FString> RequestIds;
+		bool bBatch;
+	};
+
+	struct FLane
+	{
+		//FIFO, items before Head are already sent
+		TArray<FOutgoingFrame> Queue;
+		int32 Head = 0;
+		int64 QueuedBytes = 0;
+		//0 means unlimited
+		int32 BytesPerTick = 0;
+		//remaining budget of the current tick, negative when a big message has been written
+		int64 Budget = 0;
+
+		int64 SentMessages = 0;
+		int64 SentBytes = 0;
+		double TotalWait = 0;
+		int64 WaitedMessages = 0;
+		float MaxWait = 0;
+
+		bool HasQueued() const { return Head < Queue.Num(); }
+	};
+
+	static const int NumLanes = 3;
+	FLane Lanes[NumLanes];
+	uint64 LastRefillFrame = 0;
+	//method -> lane
+	TMap<FString, EJwRpcLane> MethodLanes;
+
+	struct FCoalescedNotify
+	{
+		FString Method;
+		//only one of them is set. params are serialized when flushed
+		TSharedPtr<FJsonValue> Params;
+		FString ParamsString;
+		EJwRpcLane Lane;
+	};
+
+	//(method, key) -> latest notification
+	TMap<TPair<FString, FString>, FCoalescedNotify> CoalescedNotifies;
+	//seconds between two flushes of coalesced notifications
+	float CoalesceInterval = 0.05f;
+	float LastCoalesceFlushTime = 0;
+
+	//not null while capturing traffic
+	TSharedPtr<FJwRpcTrafficRecorder> Recorder;
+
+	//BeginBatch calls that are not ended yet
+	int BatchDepth = 0;
+	//messages of the current batch
+	TArray<FString> BatchMessages;
+	//id of each message in BatchMessages, empty for notifications
+	TArray<FString> BatchRequestIds;
+	//most urgent lane of the messages in the current batch
+	EJwRpcLane BatchLane = EJwRpcLane::Bulk;
+
+	TArray<FRawMessageFilter> RawMessageFilters;
+	TArray<FOnClosed> CloseObservers;
 };
 
 
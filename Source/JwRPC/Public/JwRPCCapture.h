@@ -0,0 +1,214 @@
+// Copyright 1998-2018 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Tickable.h"
+#include "JwRPC.h"
+#include "JwRPCSocket.h"
+
+#include "JwRPCCapture.generated.h"
+
+class IMappedFileHandle;
+class IMappedFileRegion;
+
+enum class EJwRpcFrameDirection : uint8
+{
+	Incoming,
+	Outgoing,
+};
+
+/*
+writes the traffic of a connection to an append only binary file.
+
+the file starts with "JWRC" and a uint32 version, followed by frames:
+	uint64	microseconds since the capture started
+	uint8	EJwRpcFrameDirection
+	uint32	size of data
+	uint8[]	the message as UTF-8
+*/
+class JWRPC_API FJwRpcTrafficRecorder
+{
+public:
+	static const uint32 Version = 1;
+
+	//returns null if the file can't be created
+	static TSharedPtr<FJwRpcTrafficRecorder> Create(const FString& filePath);
+
+	~FJwRpcTrafficRecorder();
+
+	void Record(EJwRpcFrameDirection direction, const FString& data);
+	void Flush();
+
+private:
+	FJwRpcTrafficRecorder() {}
+
+	FArchive* Writer = nullptr;
+	double StartTime = 0;
+	double LastFlushTime = 0;
+};
+
+struct FJwRpcCapturedFrame
+{
+	//seconds since the capture started
+	double Time = 0;
+	EJwRpcFrameDirection Direction = EJwRpcFrameDirection::Incoming;
+	//points into the mapped file, not null terminated
+	const ANSICHAR* Data = nullptr;
+	int32 Size = 0;
+
+	FString ToString() const;
+};
+
+/*
+reads a file written by FJwRpcTrafficRecorder. the file is memory mapped when the platform supports it.
+*/
+class JWRPC_API FJwRpcCaptureReader
+{
+public:
+	//returns null if the file can't be opened or is not a capture
+	static TUniquePtr<FJwRpcCaptureReader> Open(const FString& filePath);
+
+	~FJwRpcCaptureReader();
+
+	//reads the next frame. returns false at the end of file
+	bool Read(FJwRpcCapturedFrame& outFrame);
+
+private:
+	FJwRpcCaptureReader() {}
+
+	IMappedFileHandle* MappedHandle = nullptr;
+	IMappedFileRegion* MappedRegion = nullptr;
+	//used if mapping is not supported
+	TArray<uint8> Loaded;
+
+	const uint8* Data = nullptr;
+	int64 Size = 0;
+	int64 Offset = 0;
+};
+
+/*
+fake transport used for replays. what the connection sends is counted and kept till the replayer takes it.
+*/
+class JWRPC_API FJwRpcReplaySocket : public FJwRpcSocketBase
+{
+public:
+	virtual void Connect() override;
+	virtual void Close(int32 Code = 1000, const FString& Reason = FString()) override;
+	virtual bool IsConnected() override { return bConnected; }
+	virtual void Send(const FString& Data) override;
+	using FJwRpcSocketBase::Send;
+
+	//delivers a message to the connection as if it was received from the network
+	void Receive(const FString& data);
+
+	int32 NumSent = 0;
+	int64 BytesSent = 0;
+	//messages sent since the replayer last took them
+	TArray<FString> Sent;
+
+private:
+	bool bConnected = false;
+};
+
+USTRUCT(BlueprintType)
+struct JWRPC_API FJwRpcReplayStats
+{
+	GENERATED_BODY()
+
+	//number of incoming messages delivered to the connection
+	UPROPERTY(BlueprintReadOnly)
+	int FramesDispatched = 0;
+	//number of outgoing messages in the capture
+	UPROPERTY(BlueprintReadOnly)
+	int CapturedOutgoing = 0;
+	//captured responds whose request has not been sent by the connection during the replay, they are not delivered
+	UPROPERTY(BlueprintReadOnly)
+	int SkippedResponds = 0;
+	//number of messages the connection has sent during the replay
+	UPROPERTY(BlueprintReadOnly)
+	int ReplayedOutgoing = 0;
+	//seconds spent in the connection handling incoming messages
+	UPROPERTY(BlueprintReadOnly)
+	float TotalDispatchTime = 0;
+	UPROPERTY(BlueprintReadOnly)
+	float MaxDispatchTime = 0;
+	//max seconds the connection spent on the frames of a single tick, that's what it adds to the frame time.
+	//reading and remapping the captured frames is not included
+	UPROPERTY(BlueprintReadOnly)
+	float MaxTickTime = 0;
+	UPROPERTY(BlueprintReadOnly)
+	int Ticks = 0;
+	UPROPERTY(BlueprintReadOnly)
+	bool bFinished = false;
+};
+
+/*
+feeds a capture written by UJwRpcConnection::StartCapture into a new connection through a fake transport.
+incoming messages are delivered at their captured time scaled by the speed, outgoing ones are only counted.
+the ids of the captured requests are paired with the ids the connection uses for the same methods, in order,
+so captured responds reach the requests of the replay. a respond with no such request is skipped.
+the returned object must be referenced to keep the replay running.
+*/
+UCLASS(BlueprintType)
+class JWRPC_API UJwRpcReplayer : public UObject, public FTickableGameObject
+{
+	GENERATED_BODY()
+public:
+
+	/*
+	@param filePath			- the capture file
+	@param connectionClass	- class of the connection that receives the messages
+	@param speed			- 1 is real time, 2 twice as fast, ... 0 or less dispatches as fast as possible
+	*/
+	UFUNCTION(BlueprintCallable)
+	static UJwRpcReplayer* StartReplay(const FString& filePath, TSubclassOf<UJwRpcConnection> connectionClass, float speed = 1);
+
+	UFUNCTION(BlueprintCallable)
+	void Stop();
+
+	UFUNCTION(BlueprintPure)
+	UJwRpcConnection* GetConnection() const { return Connection; }
+	UFUNCTION(BlueprintPure)
+	FJwRpcReplayStats GetStats() const;
+
+	//max messages dispatched per tick when replaying as fast as possible
+	UPROPERTY(BlueprintReadWrite)
+	int MaxFramesPerTick = 10000;
+
+protected:
+	void Tick(float DeltaTime) override;
+	bool IsTickable() const override;
+	TStatId GetStatId() const override;
+
+	void Finish();
+	//records the ids of the requests in a message. method -> ids
+	static void CollectRequestIds(const FString& data, TMap<FString, TArray<FString>>& into);
+	//takes the messages the connection has sent and pairs their request ids with the captured ones
+	void CollectReplayedRequests();
+	void PairRequestIds();
+	/*
+	replaces the captured ids of the responds in a message with the ids of the replay.
+	@return false if nothing is left to deliver
+	*/
+	bool RemapResponds(const FString& message, FString& outMessage);
+
+	UPROPERTY()
+	UJwRpcConnection* Connection = nullptr;
+
+	TUniquePtr<FJwRpcCaptureReader> Reader;
+	TSharedPtr<FJwRpcReplaySocket> Socket;
+
+	FJwRpcCapturedFrame PendingFrame;
+	bool bHasPendingFrame = false;
+
+	//method -> ids of the requests not paired yet
+	TMap<FString, TArray<FString>> CapturedRequestIds;
+	TMap<FString, TArray<FString>> ReplayedRequestIds;
+	//captured request id -> id of the same request in the replay
+	TMap<FString, FString> RequestIdMap;
+
+	float Speed = 1;
+	double ReplayTime = 0;
+	FJwRpcReplayStats Stats;
+};
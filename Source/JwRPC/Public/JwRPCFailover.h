@@ -0,0 +1,196 @@
+// Copyright 1998-2018 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Tickable.h"
+#include "JwRPC.h"
+
+#include "JwRPCFailover.generated.h"
+
+USTRUCT(BlueprintType)
+struct JWRPC_API FJwRpcEndpointStats
+{
+	GENERATED_BODY()
+
+	UPROPERTY(BlueprintReadOnly)
+	FString URL;
+	UPROPERTY(BlueprintReadOnly)
+	bool bConnected = false;
+	//false while its failing, requests are routed to the other endpoints
+	UPROPERTY(BlueprintReadOnly)
+	bool bHealthy = false;
+	//smoothed respond time of the requests sent to it, -1 if unknown
+	UPROPERTY(BlueprintReadOnly)
+	float SmoothedRTT = -1;
+	UPROPERTY(BlueprintReadOnly)
+	int64 Requests = 0;
+	//timeouts, lost connections and overloaded answers. errors sent by the peer are not counted
+	UPROPERTY(BlueprintReadOnly)
+	int64 Errors = 0;
+	UPROPERTY(BlueprintReadOnly)
+	int ConsecutiveErrors = 0;
+	//duplicates sent to this endpoint and how many of them answered first
+	UPROPERTY(BlueprintReadOnly)
+	int64 HedgesSent = 0;
+	UPROPERTY(BlueprintReadOnly)
+	int64 HedgesWon = 0;
+};
+
+/*
+a set of equivalent endpoints used as one connection. every endpoint has a UJwRpcConnection of its own.
+requests go to the healthy endpoint that answers the fastest. if an endpoint is lost, idempotent requests
+are sent again to another one right away instead of waiting for its reconnect.
+idempotent requests can also be hedged: if no respond arrives within the observed percentile of the method,
+a duplicate is sent to the next best endpoint. the first respond wins and the other request is cancelled.
+*/
+UCLASS(BlueprintType)
+class JWRPC_API UJwRpcFailoverConnection : public UObject, public FTickableGameObject
+{
+	GENERATED_BODY()
+public:
+
+	/*
+	connect to all the endpoints.
+	@param urls				- urls of the equivalent endpoints
+	@param connectionClass	- class of the connection of each endpoint
+	*/
+	UFUNCTION(BlueprintCallable)
+	static UJwRpcFailoverConnection* CreateAndConnect(const TArray<FString>& urls, TSubclassOf<UJwRpcConnection> connectionClass);
+
+	/*
+	send a request to the best endpoint.
+	@return the id of the request, its not the id sent to the peer
+	*/
+	FString Request(const FString& method, const FString& params, UJwRpcConnection::FSuccessCB onSuccess = nullptr, UJwRpcConnection::FErrorCB onError = nullptr);
+	FString Request(const FString& method, TSharedPtr<FJsonValue> params, UJwRpcConnection::FSuccessCB onSuccess = nullptr, UJwRpcConnection::FErrorCB onError = nullptr);
+	//send a notification to the best endpoint
+	void Notify(const FString& method, const FString& params);
+	void Notify(const FString& method, TSharedPtr<FJsonValue> params);
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "Request"))
+	FString K2_Request(const FString& method, const FString& params, FOnRPCResult onSuccess, FOnRPCError onError);
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "Notify"))
+	void K2_Notify(const FString& method, const FString& params);
+
+	//cancels all the sent copies of the request. callbacks are not called
+	UFUNCTION(BlueprintCallable)
+	bool CancelRequest(const FString& id);
+
+	//register a notification callback on all the endpoints
+	void RegisterNotificationCallback(const FString& method, UJwRpcConnection::FNotifyCB callback);
+	//register a request callback on all the endpoints
+	void RegisterRequestCallback(const FString& method, UJwRpcConnection::FRequestCB callback);
+
+	/*
+	mark a method as safe to be executed more than once. only these are hedged or sent again after a lost connection.
+	*/
+	UFUNCTION(BlueprintCallable)
+	void SetIdempotent(const FString& method, bool bIdempotent = true);
+	/*
+	@param bEnable		- whether idempotent requests are hedged
+	@param percentile	- a duplicate is sent if no respond arrives within this percentile of the method's respond times
+	@param minDelay		- duplicates are never sent sooner than this
+	*/
+	UFUNCTION(BlueprintCallable)
+	void SetHedging(bool bEnable, float percentile = 0.95f, float minDelay = 0.005f);
+	/*
+	@param maxConsecutiveErrors	- an endpoint with this many errors in a row is unhealthy
+	@param cooldown				- seconds an unhealthy endpoint is avoided, after that its tried again
+	*/
+	UFUNCTION(BlueprintCallable)
+	void SetFailureThreshold(int maxConsecutiveErrors = 3, float cooldown = 5);
+
+	UFUNCTION(BlueprintPure)
+	TArray<FJwRpcEndpointStats> GetEndpointStats() const;
+	UFUNCTION(BlueprintPure)
+	TArray<UJwRpcConnection*> GetConnections() const { return Connections; }
+	//connection of the endpoint requests are currently routed to, null if there is no endpoint
+	UFUNCTION(BlueprintPure)
+	UJwRpcConnection* GetBestConnection() const;
+
+	UFUNCTION(BlueprintCallable)
+	void Close();
+
+	void BeginDestroy() override;
+
+protected:
+	void Tick(float DeltaTime) override;
+	bool IsTickable() const override;
+	TStatId GetStatId() const override;
+
+	struct FEndpoint
+	{
+		//respond times of the requests we sent. RFC 6298 smoothing
+		float SmoothedRTT = -1;
+		double LastSampleTime = 0;
+		double LastErrorTime = 0;
+		int64 Requests = 0;
+		int64 Errors = 0;
+		int ConsecutiveErrors = 0;
+		int64 HedgesSent = 0;
+		int64 HedgesWon = 0;
+	};
+
+	struct FAttempt
+	{
+		int Endpoint;
+		FString Id;
+		double SendTime;
+		bool bHedge;
+	};
+
+	struct FFailoverRequest
+	{
+		FString Method;
+		FString Params;
+		UJwRpcConnection::FSuccessCB OnResult;
+		UJwRpcConnection::FErrorCB OnError;
+		bool bIdempotent = false;
+		//0 if no duplicate should be sent
+		double HedgeTime = 0;
+		//copies in flight
+		TArray<FAttempt, TInlineAllocator<2>> Attempts;
+		//endpoints already tried
+		TArray<int, TInlineAllocator<4>> Tried;
+	};
+
+	bool IsHealthy(int endpoint, double now) const;
+	//the lower the better
+	float GetScore(int endpoint, double now) const;
+	//returns INDEX_NONE if there is no endpoint left
+	int SelectEndpoint(const TArray<int, TInlineAllocator<4>>& exclude) const;
+	//sends a copy of the request to the endpoint
+	void SendAttempt(const FString& id, FFailoverRequest& request, int endpoint, bool bHedge);
+	void OnAttemptResult(TSharedPtr<FJsonValue> result, FString id, int endpoint);
+	void OnAttemptError(const FJwRPCError& error, FString id, int endpoint);
+	//seconds before hedging a request of the method, 0 if it should not be hedged
+	float GetHedgeDelay(const FString& method) const;
+	void AddSample(int endpoint, double seconds);
+	void AddError(int endpoint);
+	static bool IsTransportError(const FJwRPCError& error);
+
+	UPROPERTY()
+	TArray<UJwRpcConnection*> Connections;
+	TArray<FString> URLs;
+	TArray<FEndpoint> Endpoints;
+
+	TMap<FString, FFailoverRequest> Requests;
+	//requests waiting for their hedge time
+	TSet<FString> HedgeQueue;
+	int IdCounter = 0;
+
+	TSet<FString> IdempotentMethods;
+	bool bHedging = false;
+	float HedgePercentile = 0.95f;
+	float MinHedgeDelay = 0.005f;
+	//hedging starts once a method has this many samples
+	int MinHedgeSamples = 16;
+	//method -> respond times of the single requests
+	TMap<FString, UJwRpcConnection::FLatencyHistory> Latencies;
+
+	int MaxConsecutiveErrors = 3;
+	float ErrorCooldown = 5;
+	//RTT samples older than this are replaced by the heartbeat RTT of the connection. so a slow endpoint is tried again once it recovers
+	float SampleLifetime = 10;
+};
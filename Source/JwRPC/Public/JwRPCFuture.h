@@ -0,0 +1,117 @@
+// Copyright 1998-2018 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Async/TaskGraphInterfaces.h"
+#include "JwRPC.h"
+
+//outcome of a request. Error.Code is 0 if it succeeded
+struct JWRPC_API FJwRpcResult
+{
+	TSharedPtr<FJsonValue> Value;
+	FJwRPCError Error;
+	//for WhenAny, index of the future that finished first
+	int Index = INDEX_NONE;
+
+	bool IsOk() const { return Error.Code == 0; }
+};
+
+//a request for UJwRpcConnection::RequestAll
+struct JWRPC_API FJwRpcCall
+{
+	FString Method;
+	FString Params;
+};
+
+struct FJwRpcFutureState;
+
+/*
+result of a request that may not have arrived yet. copies refer to the same result.
+continuations run on the thread they are given. if the result is set on that thread already they run right away,
+so a chain of continuations on the same thread doesn't go through the task graph.
+json values are not thread safe, so a continuation on another thread receives a copy of the value parsed on that thread.
+a result set on the game thread is serialized only when another thread needs it, on the game thread.
+
+	conn->RequestAsync("getUser", params)
+		.Chain([conn](const FJwRpcResult& user) { return conn->RequestAsync("getInventory", user.Value); })
+		.Then([](const FJwRpcResult& inventory) { ... }, ENamedThreads::AnyBackgroundThreadNormalTask);
+*/
+class JWRPC_API FJwRpcFuture
+{
+public:
+	typedef TFunction<void(const FJwRpcResult&)> FContinuation;
+	typedef TFunction<FJwRpcFuture(const FJwRpcResult&)> FChainedContinuation;
+
+	//invalid future, it never gets ready
+	FJwRpcFuture() {}
+
+	bool IsValid() const { return State.IsValid(); }
+	//on other threads, a result set on the game thread is ready once the game thread has serialized it for them
+	bool IsReady() const;
+	//the result, only valid once its ready. on the game thread it's the value it was set with, other threads parse it again on each call
+	FJwRpcResult GetResult() const;
+
+	/*
+	call a function once the result is ready.
+	@return a future with the same result that gets ready after the function ran
+	*/
+	FJwRpcFuture Then(FContinuation continuation, ENamedThreads::Type thread = ENamedThreads::GameThread) const;
+	/*
+	start another asynchronous operation once the result is ready. e.g a request that depends on this one
+	@return a future with the result of the future the function returns
+	*/
+	FJwRpcFuture Chain(FChainedContinuation continuation, ENamedThreads::Type thread = ENamedThreads::GameThread) const;
+
+	/*
+	ready when all of the futures are. the value is an array of their values, null for the failed ones.
+	the error is the error of the first failed future.
+	to send all the requests in one write use UJwRpcConnection::RequestAll or FJwRpcBatchScope
+	*/
+	static FJwRpcFuture WhenAll(const TArray<FJwRpcFuture>& futures);
+	//ready when any of the futures is. the result is its result, Index tells which one
+	static FJwRpcFuture WhenAny(const TArray<FJwRpcFuture>& futures);
+
+	static FJwRpcFuture MakeReady(const FJwRpcResult& result);
+
+private:
+	friend class FJwRpcPromise;
+
+	//runs on the thread that sets the result
+	void OnReady(FContinuation continuation) const;
+
+	TSharedPtr<FJwRpcFutureState, ESPMode::ThreadSafe> State;
+};
+
+/*
+the writing side of a FJwRpcFuture. only the first result is taken, the later ones are ignored.
+*/
+class JWRPC_API FJwRpcPromise
+{
+public:
+	FJwRpcPromise();
+
+	FJwRpcFuture GetFuture() const;
+
+	void SetResult(const FJwRpcResult& result) const;
+	void SetValue(TSharedPtr<FJsonValue> value) const;
+	void SetError(const FJwRPCError& error) const;
+
+private:
+	friend class FJwRpcFuture;
+
+	TSharedRef<FJwRpcFutureState, ESPMode::ThreadSafe> State;
+};
+
+/*
+requests and notifications sent through the connection while the scope is alive are written as one JSON-RPC batch.
+scopes can be nested, the batch is written when the outermost one ends.
+*/
+struct JWRPC_API FJwRpcBatchScope
+{
+	explicit FJwRpcBatchScope(UJwRpcConnection* connection);
+	~FJwRpcBatchScope();
+
+private:
+	TWeakObjectPtr<UJwRpcConnection> Connection;
+};
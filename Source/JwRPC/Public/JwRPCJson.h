@@ -0,0 +1,74 @@
+// Copyright 1998-2018 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Kismet/BlueprintFunctionLibrary.h"
+#include "JsonValue.h"
+
+#include "JwRPCJson.generated.h"
+
+class UJsonValue;
+
+/*
+lightweight handle to a json value for blueprints.
+unlike UJsonValue its not a UObject, so receiving messages doesn't create anything for the garbage collector.
+use the functions of UJwRpcJsonLibrary to read it, or ToJsonValue to convert it when JsonBP nodes are needed.
+*/
+USTRUCT(BlueprintType)
+struct JWRPC_API FJwRpcJson
+{
+	GENERATED_BODY()
+
+	TSharedPtr<FJsonValue> Value;
+
+	FJwRpcJson() {}
+	FJwRpcJson(TSharedPtr<FJsonValue> value) : Value(value) {}
+};
+
+UCLASS()
+class JWRPC_API UJwRpcJsonLibrary : public UBlueprintFunctionLibrary
+{
+	GENERATED_BODY()
+public:
+
+	//false if there is no value at all. e.g a missing field
+	UFUNCTION(BlueprintPure, Category = "JwRPC|Json")
+	static bool IsValid(const FJwRpcJson& json);
+	UFUNCTION(BlueprintPure, Category = "JwRPC|Json")
+	static bool IsNull(const FJwRpcJson& json);
+
+	UFUNCTION(BlueprintPure, Category = "JwRPC|Json")
+	static FString AsString(const FJwRpcJson& json);
+	UFUNCTION(BlueprintPure, Category = "JwRPC|Json")
+	static float AsNumber(const FJwRpcJson& json);
+	UFUNCTION(BlueprintPure, Category = "JwRPC|Json")
+	static int AsInt(const FJwRpcJson& json);
+	UFUNCTION(BlueprintPure, Category = "JwRPC|Json")
+	static bool AsBool(const FJwRpcJson& json);
+
+	//field of an object. returns an invalid handle if its not an object or has no such field
+	UFUNCTION(BlueprintPure, Category = "JwRPC|Json")
+	static FJwRpcJson GetField(const FJwRpcJson& json, const FString& name);
+	UFUNCTION(BlueprintPure, Category = "JwRPC|Json")
+	static bool HasField(const FJwRpcJson& json, const FString& name);
+	UFUNCTION(BlueprintPure, Category = "JwRPC|Json")
+	static TArray<FString> GetFieldNames(const FJwRpcJson& json);
+
+	//element of an array. returns an invalid handle if its not an array or index is out of range
+	UFUNCTION(BlueprintPure, Category = "JwRPC|Json")
+	static FJwRpcJson GetItem(const FJwRpcJson& json, int index);
+	//number of elements if its an array, otherwise 0
+	UFUNCTION(BlueprintPure, Category = "JwRPC|Json")
+	static int Num(const FJwRpcJson& json);
+
+	UFUNCTION(BlueprintPure, Category = "JwRPC|Json")
+	static FString ToString(const FJwRpcJson& json, bool bPretty = false);
+	//parses a string containing any json value. returns an invalid handle if it fails
+	UFUNCTION(BlueprintPure, Category = "JwRPC|Json")
+	static FJwRpcJson Parse(const FString& string);
+
+	//converts to JsonBP's UJsonValue. this creates UObjects, use it only when you need it
+	UFUNCTION(BlueprintPure, Category = "JwRPC|Json")
+	static UJsonValue* ToJsonValue(const FJwRpcJson& json);
+};
@@ -0,0 +1,110 @@
+// Copyright 1998-2018 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Tickable.h"
+#include "JwRPC.h"
+
+#include "JwRPCRelay.generated.h"
+
+/*
+forwards the allowed methods sent by source connections to a target connection without parsing the messages.
+only the id of a request is replaced so that its respond can be routed back, the rest of the message is copied as it is.
+e.g a game server forwarding the requests of its clients (see UJwRpcServer) to a backend service.
+
+requests that time out or are pending when the target disconnects are answered with an error.
+closing of the connections is observed, the relay only ticks when a request is due to expire.
+batches are not forwarded, they are handled by the source connection as usual.
+*/
+UCLASS(BlueprintType)
+class JWRPC_API UJwRpcRelay : public UObject, public FTickableGameObject
+{
+	GENERATED_BODY()
+public:
+
+	UFUNCTION(BlueprintCallable)
+	static UJwRpcRelay* CreateRelay(UJwRpcConnection* target);
+
+	//starts forwarding the allowed messages of the connection
+	UFUNCTION(BlueprintCallable)
+	void AddSource(UJwRpcConnection* source);
+	//stops forwarding. its pending requests are cancelled on the target
+	UFUNCTION(BlueprintCallable)
+	void RemoveSource(UJwRpcConnection* source);
+
+	//forward the method with this exact name
+	UFUNCTION(BlueprintCallable)
+	void AllowMethod(const FString& method);
+	//forward all the methods starting with this. e.g "inventory."
+	UFUNCTION(BlueprintCallable)
+	void AllowPrefix(const FString& prefix);
+
+	//seconds before a forwarded request is answered by FJwRPCError::Timeout. requests forwarded already keep their timeout
+	UFUNCTION(BlueprintCallable)
+	void SetTimeout(float seconds) { Timeout = FMath::Max(0.001f, seconds); }
+
+	UFUNCTION(BlueprintPure)
+	int GetNumPending() const { return Pending.Num(); }
+	UFUNCTION(BlueprintPure)
+	int64 GetNumForwarded() const { return NumForwarded; }
+
+	//stops forwarding, the pending requests are answered by FJwRPCError::NoConnection
+	UFUNCTION(BlueprintCallable)
+	void Close();
+
+	void BeginDestroy() override;
+
+protected:
+	void Tick(float DeltaTime) override;
+	bool IsTickable() const override;
+	TStatId GetStatId() const override;
+
+	bool IsAllowed(const FString& method) const;
+	bool OnSourceMessage(const FString& data, TWeakObjectPtr<UJwRpcConnection> source);
+	bool OnTargetMessage(const FString& data);
+	void OnTargetClosed(int32 StatusCode, const FString& Reason, bool bWasClean);
+	void OnSourceClosed(int32 StatusCode, const FString& Reason, bool bWasClean, TWeakObjectPtr<UJwRpcConnection> source);
+	//stops watching the source
+	void UnbindSource(UJwRpcConnection* source);
+	//answers a pending request with an error
+	void FailPending(uint32 key, const FJwRPCError& error, bool bCancelOnTarget);
+	void FailAll(const FJwRPCError& error, bool bCancelOnTarget);
+	FString MakeTargetId(uint32 key) const;
+	//drops the entries of the requests that are not pending anymore once they are the majority
+	void CompactExpireHeap();
+
+	struct FPendingRequest
+	{
+		TWeakObjectPtr<UJwRpcConnection> Source;
+		//the id as it was in the message, quotes included
+		FString SourceId;
+		double ExpireTime;
+	};
+
+	struct FExpireEntry
+	{
+		double ExpireTime;
+		uint32 Key;
+
+		bool operator < (const FExpireEntry& other) const { return ExpireTime < other.ExpireTime; }
+	};
+
+	UPROPERTY()
+	UJwRpcConnection* Target = nullptr;
+	UPROPERTY()
+	TArray<UJwRpcConnection*> Sources;
+
+	TSet<FString> Methods;
+	TArray<FString> Prefixes;
+
+	//ids sent to the target are IdPrefix followed by the key
+	FString IdPrefix;
+	uint32 NextKey = 0;
+	TMap<uint32, FPendingRequest> Pending;
+	//min heap of the expire times. entries of the requests that are answered already stay till they are popped or compacted
+	TArray<FExpireEntry> ExpireHeap;
+
+	float Timeout = 60;
+	int64 NumForwarded = 0;
+};
@@ -0,0 +1,226 @@
+// Copyright 1998-2018 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Tickable.h"
+#include "IWebSocketServer.h"
+#include "INetworkingWebSocket.h"
+#include "JwRPC.h"
+#include "JwRPCSocket.h"
+
+#include "JwRPCServer.generated.h"
+
+//an encoded message. broadcasts share one of these between all the recipients
+typedef TSharedRef<const TArray<uint8>> FJwRpcSharedFrame;
+
+/*
+a client accepted by UJwRpcServer, seen through IWebSocket so that a UJwRpcConnection can serve it.
+outgoing messages wait in a queue of its own and are handed to the socket at a limited rate per tick.
+the socket doesn't tell how much of its buffer is written, so when a send window is set, after every quarter of it a $/ping
+request is sent and its respond acknowledges the bytes before it. JwRPC peers answer these by themselves, other peers
+would stall the window, so it is off unless enabled.
+no more than the send window is handed to the socket without being acknowledged, the rest waits in our queue.
+*/
+class JWRPC_API FJwRpcServerClientSocket : public FJwRpcSocketBase
+{
+public:
+	explicit FJwRpcServerClientSocket(INetworkingWebSocket* socket);
+	virtual ~FJwRpcServerClientSocket();
+
+	//the client is already connected, this only reports it
+	virtual void Connect() override;
+	virtual void Close(int32 Code = 1000, const FString& Reason = FString()) override;
+	virtual bool IsConnected() override { return bConnected; }
+	virtual void Send(const FString& Data) override;
+	using FJwRpcSocketBase::Send;
+
+	//queues an encoded message without copying it
+	void SendShared(const FJwRpcSharedFrame& frame);
+	/*
+	hands the queued messages to the socket.
+	@param bytesBudget		- max bytes handed in this call. 0 or less means no limit
+	@param sendWindow		- max bytes handed to the socket and not acknowledged yet. 0 or less means no limit
+	@param maxQueuedBytes	- more bytes waiting than this makes the client a slow consumer. 0 or less means no limit
+	@param maxQueueWait		- a message waiting longer than this makes the client a slow consumer. 0 or less means no limit
+	@return false if the client is a slow consumer and should be evicted
+	*/
+	bool Flush(int64 bytesBudget, int64 sendWindow, int64 maxQueuedBytes, float maxQueueWait);
+	//deletes the underlying socket. nothing is sent or received after this
+	void Release();
+
+	int64 GetQueuedBytes() const { return QueuedBytes; }
+	//bytes handed to the socket that the client has not acknowledged yet
+	int64 GetUnackedBytes() const { return UnackedBytes; }
+	const FString& GetRemoteAddress() const { return RemoteAddress; }
+
+private:
+	void OnReceive(void* data, int32 size);
+	void OnSocketClosed();
+	//consumes the respond of an acknowledgement request. returns false if the message is something else
+	bool HandleAck(const FString& message);
+	void ResetQueue();
+
+	struct FQueuedFrame
+	{
+		FJwRpcSharedFrame Data;
+		double QueueTime;
+	};
+
+	INetworkingWebSocket* Socket;
+	TArray<FQueuedFrame> Queue;
+	//index of the first unsent frame in Queue
+	int32 Head = 0;
+	int64 QueuedBytes = 0;
+
+	struct FAckMark
+	{
+		uint32 Id;
+		//bytes handed to the socket before the acknowledgement request, since the previous one
+		int64 Bytes;
+	};
+
+	//acknowledgement requests that are not answered yet, oldest first
+	TArray<FAckMark> AckMarks;
+	uint32 NextAckId = 0;
+	int64 UnackedBytes = 0;
+	//bytes handed since the last acknowledgement request
+	int64 BytesSinceAck = 0;
+
+	bool bConnected = false;
+	FString RemoteAddress;
+};
+
+/*
+accepts JSON-RPC clients over websocket. each client is a UJwRpcConnection of the given class,
+so requests and notifications of clients are handled just like the ones of an outgoing connection.
+callbacks registered on the server are given to all the clients.
+*/
+UCLASS(BlueprintType)
+class JWRPC_API UJwRpcServer : public UObject, public FTickableGameObject
+{
+	GENERATED_BODY()
+public:
+
+	/*
+	start accepting clients.
+	@param port			- the port to listen on
+	@param clientClass	- class of the connections that serve the clients
+	@return null if listening failed
+	*/
+	UFUNCTION(BlueprintCallable)
+	static UJwRpcServer* Listen(int port, TSubclassOf<UJwRpcConnection> clientClass);
+
+	//disconnects all the clients and stops listening
+	UFUNCTION(BlueprintCallable)
+	void Stop();
+	UFUNCTION(BlueprintPure)
+	bool IsListening() const { return Server.IsValid(); }
+
+	UFUNCTION(BlueprintPure)
+	TArray<UJwRpcConnection*> GetClients() const { return Clients; }
+	UFUNCTION(BlueprintPure)
+	int GetNumClients() const { return Clients.Num(); }
+	//number of clients disconnected for not reading their messages fast enough
+	UFUNCTION(BlueprintPure)
+	int GetNumEvictedClients() const { return NumEvictedClients; }
+	UFUNCTION(BlueprintCallable)
+	void DisconnectClient(UJwRpcConnection* client, int code = 1000, const FString& reason = TEXT(""));
+
+	/*
+	set how the messages waiting for a client are limited. a client that exceeds them is disconnected.
+	its UJwRpcConnection is closed with code 1008, the client itself only sees the socket closing
+	since WebSocketNetworking can't send close codes.
+	@param maxQueuedBytes	- max bytes waiting for a client. 0 means unlimited
+	@param maxQueueWait		- max seconds a message may wait. 0 means unlimited
+	@param bytesPerTick		- max bytes handed to the socket of a client per tick. 0 means unlimited
+	@param sendWindow		- max bytes handed to the socket of a client that it has not acknowledged. 0 means unlimited.
+							  only for clients that answer $/ping, such as JwRPC connections
+	*/
+	UFUNCTION(BlueprintCallable)
+	void SetClientSendLimits(int maxQueuedBytes = 4194304, float maxQueueWait = 10, int bytesPerTick = 262144, int sendWindow = 0);
+
+	/*
+	register a notification callback for all the clients.
+	*/
+	void RegisterNotificationCallback(const FString& method, UJwRpcConnection::FNotifyCB callback);
+	/*
+	register a request callback for all the clients.
+	*/
+	void RegisterRequestCallback(const FString& method, UJwRpcConnection::FRequestCB callback);
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "RegisterNotificationCallback"))
+	void K2_RegisterNotificationCallback(const FString& method, FNotificationDD callback);
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "RegisterRequestCallback"))
+	void K2_RegisterRequestCallback(const FString& method, FRequestDD callback);
+
+	/*
+	send a notification to all the clients. the message is serialized once, all the clients share the same buffer.
+	@param method	- name of the method
+	@param params	- the shared pointer containing any json value
+	*/
+	void Notify(const FString& method, TSharedPtr<FJsonValue> params);
+	void Notify(const FString& method, const FString& params);
+	/*
+	send a notification to some of the clients. the message is serialized once.
+	*/
+	void NotifyClients(const TArray<UJwRpcConnection*>& clients, const FString& method, TSharedPtr<FJsonValue> params);
+	void NotifyClients(const TArray<UJwRpcConnection*>& clients, const FString& method, const FString& params);
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "Notify"))
+	void K2_Notify(const FString& method, const FString& params);
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "Notify (json)"))
+	void K2_NotifyJSON(const FString& method, const FJwRpcJson& params);
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "NotifyClients (json)"))
+	void K2_NotifyClientsJSON(const TArray<UJwRpcConnection*>& clients, const FString& method, const FJwRpcJson& params);
+
+	/*
+	this is called when a client is accepted. its callbacks are already registered.
+	*/
+	virtual void OnClientConnected(UJwRpcConnection* client);
+	/*
+	this is called when a client is gone. the connection is closed already.
+	*/
+	virtual void OnClientDisconnected(UJwRpcConnection* client);
+
+	DECLARE_DELEGATE_OneParam(FOnClient, UJwRpcConnection* /*client*/);
+
+	FOnClient OnClientConnectedEvent;
+	FOnClient OnClientDisconnectedEvent;
+
+	UFUNCTION(BlueprintImplementableEvent, meta = (DisplayName = "OnClientConnected"))
+	void K2_OnClientConnected(UJwRpcConnection* client);
+	UFUNCTION(BlueprintImplementableEvent, meta = (DisplayName = "OnClientDisconnected"))
+	void K2_OnClientDisconnected(UJwRpcConnection* client);
+
+	void BeginDestroy() override;
+
+protected:
+	void Tick(float DeltaTime) override;
+	bool IsTickable() const override;
+	TStatId GetStatId() const override;
+
+	void OnClientSocket(INetworkingWebSocket* socket);
+	void RemoveClient(int index);
+	void RegisterCallback(const FString& method, const UJwRpcConnection::FMethodData& md);
+	//builds the notification message once
+	static FJwRpcSharedFrame EncodeNotification(const FString& method, const FString& params);
+
+	TUniquePtr<IWebSocketServer> Server;
+	TSubclassOf<UJwRpcConnection> ClientClass;
+
+	//Clients and ClientSockets have the same order
+	UPROPERTY()
+	TArray<UJwRpcConnection*> Clients;
+	TArray<TSharedPtr<FJwRpcServerClientSocket>> ClientSockets;
+
+	TMap<FString, UJwRpcConnection::FMethodData> RegisteredCallbacks;
+
+	int64 MaxClientQueuedBytes = 4 * 1024 * 1024;
+	float MaxClientQueueWait = 10;
+	int64 ClientBytesPerTick = 256 * 1024;
+	int64 ClientSendWindow = 0;
+	int NumEvictedClients = 0;
+	bool bTicking = false;
+	bool bStopPending = false;
+};
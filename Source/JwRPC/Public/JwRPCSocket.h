@@ -0,0 +1,45 @@
+// Copyright 1998-2018 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "IWebSocket.h"
+#include "Runtime/Launch/Resources/Version.h"
+
+/*
+base class for transports that are not real websockets but are used by UJwRpcConnection through IWebSocket.
+it owns the events, subclasses only implement connecting and sending.
+*/
+class JWRPC_API FJwRpcSocketBase : public IWebSocket
+{
+public:
+	//JSON-RPC messages are text. binary data is treated as UTF-8 text
+	virtual void Send(const void* Data, SIZE_T Size, bool bIsBinary = false) override;
+	virtual void Send(const FString& Data) override = 0;
+
+	virtual FWebSocketConnectedEvent& OnConnected() override { return ConnectedEvent; }
+	virtual FWebSocketConnectionErrorEvent& OnConnectionError() override { return ConnectionErrorEvent; }
+	virtual FWebSocketClosedEvent& OnClosed() override { return ClosedEvent; }
+	virtual FWebSocketMessageEvent& OnMessage() override { return MessageEvent; }
+	virtual FWebSocketRawMessageEvent& OnRawMessage() override { return RawMessageEvent; }
+#if ENGINE_MAJOR_VERSION > 4 || ENGINE_MINOR_VERSION >= 24
+	virtual FWebSocketMessageSentEvent& OnMessageSent() override { return MessageSentEvent; }
+#endif
+#if ENGINE_MAJOR_VERSION > 4 || ENGINE_MINOR_VERSION >= 25
+	//never broadcast, messages are text
+	virtual FWebSocketBinaryMessageEvent& OnBinaryMessage() override { return BinaryMessageEvent; }
+#endif
+
+protected:
+	FWebSocketConnectedEvent ConnectedEvent;
+	FWebSocketConnectionErrorEvent ConnectionErrorEvent;
+	FWebSocketClosedEvent ClosedEvent;
+	FWebSocketMessageEvent MessageEvent;
+	FWebSocketRawMessageEvent RawMessageEvent;
+#if ENGINE_MAJOR_VERSION > 4 || ENGINE_MINOR_VERSION >= 24
+	FWebSocketMessageSentEvent MessageSentEvent;
+#endif
+#if ENGINE_MAJOR_VERSION > 4 || ENGINE_MINOR_VERSION >= 25
+	FWebSocketBinaryMessageEvent BinaryMessageEvent;
+#endif
+};
@@ -0,0 +1,89 @@
+// Copyright 1998-2018 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/Runnable.h"
+#include "HAL/ThreadSafeBool.h"
+#include "JwRPCSocket.h"
+
+class FRunnableThread;
+class FJwRpcStreamListener;
+class FJwRpcStreamWorker;
+struct FJwRpcStreamChannel;
+
+struct FJwRpcStreamEvent
+{
+	enum EType
+	{
+		Connected,
+		ConnectionError,
+		Message,
+		Closed,
+	};
+
+	EType Type = Message;
+	//message, error or close reason
+	FString Data;
+};
+
+/*
+JSON-RPC over a plain stream socket instead of websocket. meant for sidecar processes on the same host.
+each message is a big endian uint32 size followed by the UTF-8 data.
+
+	tcp://127.0.0.1:9000
+	unix:///run/agent.sock	(Linux and Mac only)
+
+UJwRpcConnection picks this transport when the url has one of these schemes.
+reading is done by an IO thread, sending is done without blocking from the calling thread and the rest is left to the IO thread.
+*/
+class JWRPC_API FJwRpcStreamSocket : public FJwRpcSocketBase
+{
+public:
+	//whether the url should use this transport instead of websocket
+	static bool IsStreamURL(const FString& url);
+
+	explicit FJwRpcStreamSocket(const FString& url);
+	virtual ~FJwRpcStreamSocket();
+
+	virtual void Connect() override;
+	virtual void Close(int32 Code = 1000, const FString& Reason = FString()) override;
+	virtual bool IsConnected() override { return bConnected; }
+	virtual void Send(const FString& Data) override;
+	using FJwRpcSocketBase::Send;
+
+	//called on the game thread for the events posted by the IO thread
+	void HandleEvent(const FJwRpcStreamEvent& event);
+
+private:
+	void StopWorker();
+
+	FString URL;
+	TSharedPtr<FJwRpcStreamChannel, ESPMode::ThreadSafe> Channel;
+	FJwRpcStreamWorker* Worker = nullptr;
+	FRunnableThread* Thread = nullptr;
+	bool bConnected = false;
+};
+
+/*
+local stand-in peer for tests of the stream transport.
+requests are answered with their params as the result, notifications are sent back as they are.
+*/
+class JWRPC_API FJwRpcStreamEchoServer : public FRunnable
+{
+public:
+	//starts listening on a tcp:// or unix:// url. returns null if it fails
+	static TUniquePtr<FJwRpcStreamEchoServer> Start(const FString& url);
+
+	virtual ~FJwRpcStreamEchoServer();
+
+	virtual uint32 Run() override;
+	virtual void Stop() override { bStop = true; }
+
+private:
+	FJwRpcStreamEchoServer() {}
+
+	FJwRpcStreamListener* Listener = nullptr;
+	FRunnableThread* Thread = nullptr;
+	FThreadSafeBool bStop;
+};
@@ -0,0 +1,61 @@
+// Copyright 1998-2018 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/EngineSubsystem.h"
+#include "Tickable.h"
+
+#include "JwRPCSubsystem.generated.h"
+
+class UJwRpcConnection;
+
+/*
+drives all the connections from a single tick.
+
+connections tell the subsystem when they need to be updated next (request expiry, reconnect, heartbeat, ...).
+the wake up times are kept in a heap so idle connections cost nothing per frame.
+*/
+UCLASS()
+class JWRPC_API UJwRpcSubsystem : public UEngineSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+public:
+
+	//returns null if the engine is not initialized
+	static UJwRpcSubsystem* Get();
+
+	void Register(UJwRpcConnection* connection);
+	void Unregister(UJwRpcConnection* connection);
+
+	//wakes the connection up at the specified time. entries whose serial is not the latest of the connection are ignored
+	void Schedule(UJwRpcConnection* connection, float wakeTime, uint32 serial);
+
+	//number of connections created and not destroyed yet
+	UFUNCTION(BlueprintPure)
+	int GetNumConnections() const { return Connections.Num(); }
+
+	//max number of connections updated in one frame. the rest are updated in the next frames. 0 means unlimited
+	UPROPERTY(BlueprintReadWrite)
+	int MaxUpdatesPerFrame = 1000;
+
+protected:
+	void Tick(float DeltaTime) override;
+	bool IsTickable() const override;
+	TStatId GetStatId() const override;
+
+	struct FWakeEntry
+	{
+		float WakeTime;
+		uint32 Serial;
+		TWeakObjectPtr<UJwRpcConnection> Connection;
+
+		bool operator < (const FWakeEntry& other) const { return WakeTime < other.WakeTime; }
+	};
+
+	TSet<TWeakObjectPtr<UJwRpcConnection>> Connections;
+	//min heap of wake up times
+	TArray<FWakeEntry> WakeHeap;
+	//connections that are due in the current frame
+	TArray<FWakeEntry> DueEntries;
+};